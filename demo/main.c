@@ -113,8 +113,6 @@ void generate_new_rain(g_query *q) {
     for (int i = 0; i < ENTITY_SPAWN_CHUNK; i++) {
       gid new_rain = gq_create_entity(q);
       gq_add(q, new_rain, Position);
-
-      gq_mut(q, new_rain);
       gq_add(q, new_rain, Vec2);
       gq_add(q, new_rain, Timer);
 
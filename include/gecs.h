@@ -24,29 +24,137 @@
 #define ENTITY_REG_START    16
 #define SYSTEM_REG_START    16
 
+/* The amount of entity records allocated together in the entity index. */
+#define ENTITY_PAGE_SIZE 1024
+
+/* The amount of payload bytes command buffers allocate together. */
+#define COMMAND_BLOCK_SIZE (16 << 10)
+
+/* The default amount of ticks an archetype stays empty before it is retired,
+   see `retire_after`. */
+#define ARCHETYPE_RETIRE_DEFAULT 64
+
+/* The amount of retired archetypes kept for reuse, older ones are freed. */
+#define ARCHETYPE_POOL_SIZE 64
+
+/*-------------------------------------------------------
+ * GECS Scheduling Variables
+ *     EACH_CHUNKS_PER_THREAD: The amount of chunks `gq_each` splits a
+ *                             fragment into per thread. More chunks give
+ *                             idle threads something to steal.
+ *     EACH_GRAIN_DEFAULT: The default minimum amount of entities inside
+ *                         one `gq_each` chunk.
+ *     EACH_SERIAL_DEFAULT: The default amount of entities below which
+ *                          `gq_each` runs on the calling thread.
+ *-------------------------------------------------------*/
+#define EACH_CHUNKS_PER_THREAD 4
+#define EACH_GRAIN_DEFAULT     64
+#define EACH_SERIAL_DEFAULT    256
+
 #define SYS_READONLY 1
 #define DEFAULT      0
 
+/*-------------------------------------------------------
+ * GECS Storage Layouts
+ *     G_LAYOUT_AOS: Components of an entity are interleaved in one row.
+ *     G_LAYOUT_SOA: Each component type gets its own contiguous, aligned
+ *                   column. Use this when systems touch few components of
+ *                   wide archetypes or to vectorize over columns.
+ *     G_LAYOUT_CHUNKED: Rows are split over fixed size chunks taken from a
+ *                   pool, SoA inside each chunk. Growing never moves
+ *                   existing rows and empty chunks are recycled.
+ *     G_LAYOUT_STABLE: May be or'ed into any of the above. Removing rows
+ *                   shifts the rows behind them down instead of filling
+ *                   the holes with the last rows, so entities keep the
+ *                   order they arrived in. Removal costs O(rows after it).
+ *-------------------------------------------------------*/
+#define G_LAYOUT_AOS     0
+#define G_LAYOUT_SOA     1
+#define G_LAYOUT_CHUNKED 2
+#define G_LAYOUT_STABLE  4
+#define G_LAYOUT_MASK    3 /* Selects the layout without G_LAYOUT_STABLE. */
+
+#define COLUMN_ALIGNMENT 64        /* Byte alignment of each column. */
+#define G_CHUNK_SIZE     (16 << 10) /* Bytes of each chunk. */
+
 struct g_core {
   int64_t tick; /* The amount of times the world has progressed. */
   atomic_uint_least64_t id_gen; /* Generates unique IDs. This is typed as least
                                    and not fast uint64_t by design because of
                                    the papers smart entity bit arithmetic. */
+  /* Numbers the archetypes, apart from `id_gen` so every entity index it
+     hands out is used. Zero is left to the empty archetype. */
+  atomic_uint_least64_t archetype_ids;
+  /* Lock free stack of entity indices released for reuse. The low half is
+     the index on top, linked through the `row` of its dead record, and the
+     high half a tag bumped on every change to rule out ABA. */
+  atomic_uint_least64_t free_ids;
+  /* Incremented by every system run and every write outside of systems.
+     Columns are stamped with it so CHANGED and ADDED terms can tell what
+     happened since a system last ran. */
+  atomic_int_least64_t change_tick;
   /* Flags:
-      `invalidate_fsm` - When set to 1, it will reprocess the FSM graph before
-                      next tick.
       `is_main` - When set to 1, it represents this world is the sequential
                 one in the graph to prevent infinite recursion.
       `disable_concurrency` - Deny the ECS from making and using threads. */
-  int8_t invalidate_fsm, is_sequential, disable_concurrency;
+  int8_t is_sequential, disable_concurrency;
+
+  /* The amount of threads used to process archetypes, including the thread
+     calling `g_progress`. Defaults to the core count of the machine and can
+     be changed until the first call to `g_progress`. */
+  int64_t    thread_count;
+  scheduler *workers; /* Worker pool, created on the first concurrent tick. */
+
+  /* `gq_each` tuning. Fragments with less than `each_serial_threshold`
+     entities are processed without the pool. Larger ones are split into
+     chunks of at least `each_grain_size` entities. */
+  int64_t each_grain_size, each_serial_threshold;
+
+  /* The storage layout new archetypes use unless overridden in
+     `layout_registry`, G_LAYOUT_STABLE may be or'ed in. Defaults to
+     G_LAYOUT_AOS. */
+  int8_t storage_layout;
+
+  /* Archetypes without entities for `retire_after` ticks leave the world.
+     Their storage is released and they wait in `retired_archetypes` until
+     an entity needs the same components again. 0 keeps them forever, they
+     are still skipped by systems while empty, see `G_SYSTEM`. */
+  int64_t   retire_after;
+  cache_vec retired_archetypes; /* Vec : archetype */
 
   stalloc *allocator; /* Internal stack allocations done here. */
 
-  /* Map : hash(Ordered[comp name]) -> archetype */
+  /* Map : archetype id -> archetype. The id is the hash of the ordered
+     component names, archetypes whose keys collide take the ids following
+     it. `registry_probes` counts those for the hashes that collided. */
   hash_to_archetype archetype_registry;
+  hash_to_size      registry_probes; /* Map : hash(Ordered[comp name]) -> n */
   hash_to_size      component_registry; /* Map : hash(comp name) -> comp size */
-  id_to_hash entity_registry; /* Map : entt id -> hash(Ordered[comp name]) */
+  entity_index entity_registry; /* Sparse Set : entt id -> entity_record */
   system_vec system_registry; /* Vec : system_data */
+
+  /* Every matcher of the world. Each one is indexed under a single
+     component it requires, or kept aside when it requires none. */
+  cache_vec matchers;           /* Vec : matcher */
+  cache_vec matchers_unindexed; /* Vec : matcher */
+  cache_map matcher_index;      /* Map : g_cid -> Vec : matcher */
+
+  /* Map : hash(Ordered[comp name]) -> storage layout */
+  hash_to_size layout_registry;
+
+  /* Chunks shared by every G_LAYOUT_CHUNKED archetype of this world. */
+  chunk_pool chunk_storage;
+
+  /* One buffer per scheduler thread. Structural changes made by systems are
+     recorded here and applied at the end of the tick. `command_epoch` grows
+     whenever work is handed to or joined from other threads, so commands of
+     different buffers apply in order. Entity records remember the
+     `command_round` their last command was recorded in, the round changes
+     each time the buffers are applied. */
+  command_buffer      *commands;
+  int64_t              command_count;
+  atomic_int_least64_t command_epoch;
+  int64_t              command_round;
 };
 
 typedef struct GecID GecID;
@@ -70,12 +178,54 @@ void g_destroy_world(g_core *w);
  * Thread Unsafe Registration Operations
  *-------------------------------------------------------*/
 /* Unsafe: Register a component to the world. Ideally do this all at once in
-           the beginning. */
+           the beginning. Returns the components id, see `G_ID`. The size
+           must match the one given to `G_DECLARE`, if declared. */
 #define G_COMPONENT(w, ty) g_register_component(w, #ty, sizeof(ty))
-void g_register_component(g_core *w, char *name, size_t component_size);
+g_cid g_register_component(g_core *w, char *name, size_t component_size);
+
+/* Get the dense id of component `ty`. Ids are the same across all worlds, so
+   look them up once and keep them around for `gq_handle`. */
+#define G_ID(ty) g_component_id(#ty)
+g_cid g_component_id(char *name);
+
+/* Declare component `ty` at file scope after its definition. Its id, size and
+   alignment are fixed while the program loads, `G_CID(ty)` then reads the id
+   from a static instead of hashing the name. Declared components are also
+   stored aligned inside AoS rows. */
+#define G_DECLARE(ty)                                                          \
+  static g_cid __g_cid_##ty = -1;                                              \
+  __attribute__((constructor)) static void __g_declare_##ty(void) {            \
+    __g_cid_##ty = g_declare_component(#ty, sizeof(ty), _Alignof(ty));         \
+  }
+#define G_CID(ty) (__g_cid_##ty)
+g_cid g_declare_component(char *name, size_t size, size_t align);
+
+/* Unsafe: Choose the storage layout of the archetype with exactly the given
+           components. Must be done before the archetype is created. Or
+           G_LAYOUT_STABLE into it to keep the rows in insertion order. */
+#define G_LAYOUT(world, layout, ...)                                           \
+  g_register_layout(world, layout, "GecID, " #__VA_ARGS__)
+void g_register_layout(g_core *w, int8_t layout, char *types);
 
 /* Unsafe: Register a system to the world. Ideally do this all at once in the
-           beginning. */
+           beginning. Each component of the query may be wrapped to declare
+           how the system accesses it, `READ(Position)` or `WRITE(Velocity)`.
+           Bare components are written unless FLAGS is SYS_READONLY.
+           `WITH(Tag)` requires a component without accessing it,
+           `WITHOUT(Frozen)` skips archetypes holding it and
+           `OPTIONAL(Color)` accesses it where present, see `gq_optional`.
+           Filters are resolved once per archetype, never per entity.
+           `CHANGED(Position)` and `ADDED(Position)` require a component and
+           only process the chunks it was written to, or received by, since
+           the system last ran. Running a system counts as writing every
+           component it may write in the chunks it processed, `gq_set`
+           counts as writing the component of that entity and `gq_get` does
+           too if the system declares writing it.
+           Systems of an archetype whose accesses do not conflict run
+           concurrently, the others in registration order.
+           Archetypes without entities are not processed, so work a system
+           does besides iterating its entities is skipped while they are
+           empty. */
 #define G_SYSTEM(world, sys, FLAGS, ...)                                       \
   g_register_system(world, sys, FLAGS, #__VA_ARGS__)
 void g_register_system(g_core *w, g_system sys, int32_t FLAGS, char *query);
@@ -87,6 +237,17 @@ void g_register_system(g_core *w, g_system sys, int32_t FLAGS, char *query);
            context. */
 gid g_create_entity(g_core *w);
 
+/* Unsafe: Create `n` entities with the components `types` ("A, B") and write
+           their ids to `out_ids`. All entities are placed in their archetype
+           at once and start zeroed. */
+#define G_CREATE_ENTITIES(w, n, out_ids, ...)                                  \
+  g_create_entities(w, n, #__VA_ARGS__, out_ids)
+void g_create_entities(g_core *w, int64_t n, char *types, gid *out_ids);
+
+/* Unsafe: Create `n` entities with the components and values of `prototype`
+           and write their ids to `out_ids`. */
+void g_clone_entities(g_core *w, gid prototype, int64_t n, gid *out_ids);
+
 /* Unsafe: Add an entity `entt` to the delete queue in `w`. */
 void g_mark_delete(g_core *w, gid entt);
 
@@ -102,6 +263,8 @@ void gq_mark_delete(g_query *q, gid entt);
 /* Check if a given entity `id` is currently processable by this system. */
 bool gq_id_in(g_query *q, gid id);
 
+/* Check if the handle `id` refers to a live entity of the world. Handles of
+   deleted entities stay dead even after their index is recycled. */
 bool gq_id_alive(g_query *q, gid id);
 
 #define gq_field_by_id(q, entt, ty) (ty *)(__gq_field_by_id(q, entt, #ty))
@@ -116,7 +279,8 @@ void *__gq_field_by_id(g_query *q, gid entt, char *type);
 void g_add_component(g_core *w, gid entt, char *name);
 
 /* Unsafe: Get a component with this function outside of the `g_progres`
-           context. */
+           context. Writing through it is not seen by `CHANGED`, use
+           `G_SET_COMPONENT` for that. */
 #define G_GET_COMPONENT(w, id, ty) (ty *)(g_get_component(w, id, #ty));
 void *g_get_component(g_core *w, gid entt, char *name);
 
@@ -136,6 +300,27 @@ void g_rem_component(g_core *w, gid entt, char *name);
 #define G_HAS_COMPONENT(w, id, ty) g_has_component(w, id, #ty)
 bool g_has_component(g_core *w, gid entt, char *name);
 
+/* Unsafe: Add the components `types` ("A, B") to the `n` entities `entts`.
+           Entities sharing an archetype are moved together. */
+#define G_ADD_COMPONENT_BATCH(w, entts, n, ...)                                \
+  g_add_component_batch(w, entts, n, #__VA_ARGS__)
+void g_add_component_batch(g_core *w, gid *entts, int64_t n, char *types);
+
+/* Unsafe: Remove the components `types` from the `n` entities `entts`. */
+#define G_REM_COMPONENT_BATCH(w, entts, n, ...)                                \
+  g_rem_component_batch(w, entts, n, #__VA_ARGS__)
+void g_rem_component_batch(g_core *w, gid *entts, int64_t n, char *types);
+
+/* Unsafe: Add the components `types` to every entity that has all of the
+           components in `query`. Archetypes that already have all of `types`
+           are skipped. */
+void g_add_component_matching(g_core *w, char *query, char *types);
+
+/* Unsafe: Remove the components `types` from every entity that has all of
+           the components in `query`. Archetypes missing any of `types` are
+           skipped. */
+void g_rem_component_matching(g_core *w, char *query, char *types);
+
 /*-------------------------------------------------------
  * Thread Safe Component Operations
  *-------------------------------------------------------*/
@@ -143,9 +328,6 @@ bool g_has_component(g_core *w, gid entt, char *name);
 #define gq_add(q, id, ty) __gq_add(q, id, #ty)
 void __gq_add(g_query *q, gid id, char *name);
 
-#define gq_mut(q, id) __gq_mut(q, id);
-void __gq_mut(g_query *q, gid entt);
-
 /* Get a component `ty` of entity `entt`  */
 #define gq_get(q, id, ty) (ty *)(__gq_get(q, id, #ty))
 void *__gq_get(g_query *q, gid id, char *name);
@@ -196,14 +378,93 @@ void *__gq_field(g_pool *itr, char *type);
 #define G_GET_POOL(world, ...) g_get_pool(world, "GecID, " #__VA_ARGS__)
 g_pool g_get_pool(g_core *world, char *query);
 
+/* The amount of entities in the iterators fragment. */
+int64_t gq_length(g_pool itr);
+
+/* Same as `gq_field` for components declared with `G_DECLARE`. The column is
+   found by indexing with the static id, no hashing happens. */
+#define gq_sfield(itr, ty) (ty *)(__gq_sfield(&itr, G_CID(ty)))
+void *__gq_sfield(g_pool *itr, g_cid id);
+
 /*-------------------------------------------------------
  * Parallel Query Operations
  *-------------------------------------------------------*/
 /* Convert query `q` into a vector to process in parallel. */
 g_par gq_vectorize(g_query *q);
 
+/* Select the contiguous column of component `ty`. Index it with
+   [0, gq_par_length(vec)). Returns NULL if the fragment is not stored with
+   G_LAYOUT_SOA, use gq_chunk_column for G_LAYOUT_CHUNKED. */
+#define gq_column(vec, ty) (ty *)(__gq_column(&vec, #ty))
+void *__gq_column(g_par *vec, char *type);
+
+/* The amount of entities in the vectorized fragment. */
+int64_t gq_par_length(g_par vec);
+
+/* Resolve component `id` against the fragment once, then access rows with
+   `gq_at` without any hashing. The handle is valid until the fragment is
+   modified at the end of the tick. */
+g_field gq_handle(g_par vec, g_cid id);
+
+/* Same as `gq_handle` for a component the query marks OPTIONAL. The handle
+   is empty when the fragment does not have the component, check it once with
+   `gq_present` instead of testing every entity. */
+g_field gq_optional(g_par vec, g_cid id);
+
+/* Check if a handle from `gq_optional` refers to a column. */
+static inline bool gq_present(g_field f) { return f.stride != 0; }
+
+/* Select component `ty` of row `idx` through a handle from `gq_handle`. */
+#define gq_at(field, ty, idx) ((ty *)__gq_at(field, idx))
+static inline void *__gq_at(g_field f, int64_t idx) {
+  if (!f.chunked) return f.base + idx * f.stride;
+  int64_t slot = idx & (((int64_t)1 << f.shift) - 1);
+  return f.chunks[idx >> f.shift] + f.offset + slot * f.stride;
+}
+
+/* The amount of chunks the vectorized fragment is stored in. A G_LAYOUT_SOA
+   fragment is a single chunk. Returns 0 for G_LAYOUT_AOS fragments. */
+int64_t gq_chunk_count(g_par vec);
+
+/* Check if chunk `chunk_idx` passes the CHANGED and ADDED terms of the
+   system, always true for systems without them. `gq_each` and `gq_seq`
+   already skip the chunks that do not. */
+bool gq_chunk_changed(g_par vec, int64_t chunk_idx);
+
+/* The amount of entities stored in chunk `chunk_idx`. */
+int64_t gq_chunk_length(g_par vec, int64_t chunk_idx);
+
+/* Select the contiguous column of component `ty` inside chunk `chunk_idx`.
+   Index it with [0, gq_chunk_length(vec, chunk_idx)). */
+#define gq_chunk_column(vec, ty, chunk_idx)                                    \
+  (ty *)(__gq_chunk_column(&vec, #ty, chunk_idx))
+void *__gq_chunk_column(g_par *vec, char *type, int64_t chunk_idx);
+
 /* Process vectorized tasks on each entity existing in the vector. */
 #define gq_each(vec, func, args) __gq_each(vec, (_each)func, (void *)args);
 void __gq_each(g_par vec, _each func, void *args);
 
+/*-------------------------------------------------------
+ * View Operations
+ *-------------------------------------------------------*/
+/* Unsafe: Create a view of every archetype matching the query, written like
+           the query of `G_SYSTEM`. Archetypes created later join the view
+           as they appear, so create it once and keep it. It is freed with
+           the world. Iterate it outside of the `g_progress` context. */
+#define G_VIEW(world, ...) g_create_view(world, #__VA_ARGS__)
+matcher *g_create_view(g_core *w, char *query);
+
+/* Start iterating `view`. Call `g_view_next` before reading the iterator. */
+g_view_itr g_view_iter(matcher *view);
+
+/* Move to the next chunk of the view, skipping empty fragments. Rows
+   [start_at, stop_at) of `itr->entities` are the chunk, resolve fields with
+   `gq_handle` once per fragment. Returns false when the view is done. */
+bool g_view_next(g_view_itr *itr);
+
+/* Call `func` on every chunk of `view` in parallel. Fragments are split
+   like `gq_each` splits them, never inside a chunk. Returns once every
+   call finished. */
+void g_view_each(matcher *view, g_range func, void *args);
+
 #endif
\ No newline at end of file
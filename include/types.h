@@ -26,6 +26,18 @@ typedef uint64_t gsize;
 /* General GECS integer type. */
 typedef int64_t gint64;
 
+/* Small dense integer identifying a component type. Every component name
+   gets one the first time it is seen and keeps it for the lifetime of the
+   process, so all worlds agree on it. */
+typedef int64_t g_cid;
+
+/* Fixed width bitset with one bit per dense component id. */
+typedef struct g_signature g_signature;
+
+/* A component column resolved against one fragment. Accessing a row through
+   it needs no hashing. */
+typedef struct g_field g_field;
+
 /* Iteration structure used for sequential operations over fragments. */
 typedef struct g_pool g_pool;
 
@@ -33,6 +45,14 @@ typedef struct g_pool g_pool;
    fragments. */
 typedef struct g_par g_par;
 
+/* Iteration structure walking every fragment of a view chunk by chunk. */
+typedef struct g_view_itr g_view_itr;
+
+/* Type representing a function processing the rows [start_at, stop_at) of a
+   fragment. */
+typedef void (*g_range)(g_par vec, int64_t start_at, int64_t stop_at,
+                        void *args);
+
 /* Type representing the interface between a system and GECS */
 typedef struct g_query g_query;
 
@@ -42,9 +62,22 @@ typedef void (*g_system)(g_query *q);
 /* Type representing the system properties struct  */
 typedef struct system_data system_data;
 
+/* The archetypes matching a query, kept up to date as archetypes appear. */
+typedef struct matcher matcher;
+
+/* A fragment of entities that share the exact same components. */
+typedef struct archetype archetype;
+
+/* Where an entity is stored, see `entity_index`. */
+typedef struct entity_record entity_record;
+typedef struct entity_index  entity_index;
+
 /* The core object GECS uses to manipulate its runtime. */
 typedef struct g_core g_core;
 
+/* The worker pool GECS uses to execute archetype jobs concurrently. */
+typedef struct scheduler scheduler;
+
 /*-------------------------------------------------------
  * Generated Types
  *-------------------------------------------------------*/
@@ -55,18 +88,42 @@ typedef struct g_core g_core;
    is done manually but the type is here for type help. */
 VEC_TYPEDEC(composite, void *);
 
+/* A column describes where one component type of an archetype lives. */
+typedef struct column column;
+VEC_TYPEDEC(column_vec, column);
+
+/* A copy run moves `size` bytes of one row to another archetype. */
+typedef struct copy_run copy_run;
+VEC_TYPEDEC(copy_plan, copy_run);
+
+/* A cached transition from one archetype to another. */
+typedef struct archetype_edge archetype_edge;
+
+/* A structural change recorded by a system, applied at the end of the tick.
+   See command.h. */
+typedef struct command        command;
+typedef struct command_buffer command_buffer;
+typedef struct command_table  command_table;
+VEC_TYPEDEC(command_vec, command *);
+
+/* Fixed size blocks of component storage, see G_LAYOUT_CHUNKED. */
+typedef struct chunk_pool chunk_pool;
+VEC_TYPEDEC(chunk_vec, void *);
+
 VEC_TYPEDEC(id_vec, gid);
 VEC_TYPEDEC(int64_vec, int64_t);
+VEC_TYPEDEC(size_vec, gsize);
 
 MAP_TYPEDEC(id_to_size, gid, gsize);
 MAP_TYPEDEC(id_to_id, gid, gid);
 MAP_TYPEDEC(id_to_int64, gid, int64_t);
-MAP_TYPEDEC(id_to_archetype, gid, archetype);
+MAP_TYPEDEC(id_to_archetype, gid, archetype *);
 
 MAP_TYPEDEC(id_to_hash, gid, uint64_t);
 MAP_TYPEDEC(hash_to_size, uint64_t, gsize);
 VEC_TYPEDEC(hash_vec, uint64_t);
-MAP_TYPEDEC(hash_to_archetype, uint64_t, archetype);
+MAP_TYPEDEC(hash_to_archetype, uint64_t, archetype *);
+MAP_TYPEDEC(hash_to_edge, uint64_t, archetype_edge);
 
 SET_TYPEDEC(type_set, int64_t);
 
@@ -79,58 +136,153 @@ VEC_TYPEDEC(system_vec, system_data);
 /*-------------------------------------------------------
  * Public Structure Definitions
  *-------------------------------------------------------*/
-typedef struct archetype archetype;
-struct archetype {
-  gid      archetype_id; /* Unique identifier for this archetype. */
-  uint64_t hash_name;    /* This is the hash of hash(Ordered(types)) */
+/* The maximum amount of distinct components a process can register. Must be a
+   multiple of 256 so signatures can be compared with full AVX2 lanes. */
+#define G_MAX_COMPONENTS  256
+#define G_SIGNATURE_WORDS (G_MAX_COMPONENTS / 64)
 
-  stalloc *allocator; /* Allocator used in concurrent contexts */
+struct g_signature {
+  uint64_t words[G_SIGNATURE_WORDS];
+};
 
-  /* These two types are used for scheduling systems. Types is also used for
-     transitioning archetypes. */
-  type_set types; /* Set : [hash(comp name)] */
+struct entity_record {
+  gid        id;      /* The live handle stored here. Once released, the
+                         handle the next occupant receives with the DEL bit
+                         set. */
+  archetype *arch;    /* NULL when the entity is not in this world. */
+  int64_t    row;     /* The row of the entity inside `arch`. Dead records
+                         use it to link the free list. */
+  int64_t    pending; /* The `command_round` its last command was recorded
+                         in, see g_core. */
+};
 
-  g_core *simulation; /* Entity transition simulations are done here. */
-  g_core *belongs_to; /* Entity transition out simulations are done here. */
+/* Paged sparse set from entity index to record. Pages are allocated when an
+   index inside them is first used. Records never move once allocated. A
+   handle is alive exactly when it equals the id of its record. */
+struct entity_index {
+  entity_record **pages;      /* Pages of ENTITY_PAGE_SIZE records. */
+  int64_t         page_count; /* The amount of slots in `pages`. */
+};
 
-  /* These three members are used for indexing and component retrieval. */
-  composite    components; /* Contiguous vector of interleaved components. */
-  hash_to_size offsets;    /* Map : hash(comp id) -> gsize */
-  id_to_int64  entt_positions; /* Map : gid -> gint */
+struct column {
+  uint64_t type;         /* hash(comp name) */
+  g_cid    id;           /* Dense id of the component. */
+  gsize    size;         /* Size of one component. */
+  gsize    offset;       /* Byte offset of the component inside an AoS row. */
+  gsize    chunk_offset; /* CHUNKED: Byte offset of the column in a chunk. */
+  void    *data;         /* SoA: Contiguous aligned array of components. */
+
+  /* Change ticks of the column, one per block of rows. A block is a chunk
+     of CHUNKED archetypes and the whole column otherwise. */
+  int64_vec added;   /* Vec : block -> tick a row last received it */
+  int64_vec changed; /* Vec : block -> tick it was last written */
+};
 
-  /* The following members are made for concurrency and caching purposes. */
+struct copy_run {
+  int64_t src_col, dst_col; /* Columns the run starts at. */
+  gsize   src_off, dst_off; /* AoS: Byte offsets of the run inside the rows. */
+  gsize   size;
+};
 
-  /* A list of addresses pointing to system_data structs existing in the g_core
-     struct. */
-  system_vec contenders; /* Vec : system_data */
+struct archetype_edge {
+  archetype *to;
+  bool       packed; /* Both ends are AoS, runs may span several columns. */
+  copy_plan  plan;   /* Vec : copy_run, every component both ends share. */
+};
+
+/* Chunks released by archetypes wait here until another archetype of the
+   same world needs one. */
+struct chunk_pool {
+  pthread_mutex_t lock;
+  chunk_vec       free_chunks; /* Vec : chunk */
+};
+
+struct command {
+  int8_t   op;      /* CMD_CREATE, CMD_DESTROY, CMD_ADD, CMD_REMOVE, CMD_SET */
+  gid      entt;
+  uint64_t type;    /* hash(comp name), unused by CREATE and DESTROY. */
+  gsize    size;    /* The size of `payload` in bytes. */
+  void    *payload; /* ADD/SET: The component value, owned by the buffer. */
+  int64_t  epoch;   /* The `command_epoch` it was recorded in, see g_core. */
+  command *prev;    /* The previous command of `entt` in the same buffer. */
+};
+
+/* Commands are only ever appended by the thread owning the buffer, without
+   locking. Commands and payloads are carved out of fixed blocks so pointers
+   to them stay valid until the buffer is applied. Other threads may follow
+   them from `latest` while the owner keeps appending. */
+struct command_buffer {
+  command_vec    commands; /* Vec : command*, in the order they were recorded */
+  command_table *latest;   /* Map : entt -> its newest command, see command.c */
+  int64_t        entities; /* The amount of entities in `latest`. */
+  chunk_vec      outgrown; /* Vec : command_table replaced this tick */
+  chunk_vec      blocks;   /* Vec : COMMAND_BLOCK_SIZE bytes of payloads */
+  chunk_vec      large;    /* Vec : payloads larger than a block */
+  int64_t        block;    /* The block payloads are currently taken from. */
+  gsize          used;     /* Bytes in use inside `block`. */
+};
+
+struct archetype {
+  gid      archetype_id; /* Unique identifier for this archetype. */
+  uint64_t hash_name;    /* The id of hash(Ordered(types)), see registry */
+
+  /* These two types are used for scheduling systems. Types is also used for
+     transitioning archetypes. The signature holds the same set as bits. */
+  type_set    types;     /* Set : [hash(comp name)] */
+  g_signature signature; /* Bitset : [g_cid] */
+
+  g_core *belongs_to; /* The world whose entity index refers to our rows. */
+
+  /* These members are used for indexing and component retrieval. Data is
+     either stored interleaved in `components` (AoS), per component type
+     inside each columns `data` (SoA) or per component type inside fixed
+     size `chunks` (CHUNKED) depending on `layout`. */
+  int8_t       layout;     /* G_LAYOUT_AOS, G_LAYOUT_SOA or G_LAYOUT_CHUNKED */
+  bool         stable;     /* Rows are removed in order, see G_LAYOUT_STABLE */
+  int64_t      length;     /* The amount of rows in use. */
+  int64_t      capacity;   /* SoA: The amount of rows each column can hold. */
+  composite    components; /* AoS: Contiguous vector of interleaved rows. */
+  chunk_vec    chunks;     /* CHUNKED: Vec : chunk */
+  chunk_pool  *chunk_src;  /* CHUNKED: Pool chunks are taken from. */
+  int8_t       chunk_shift; /* CHUNKED: log2(rows per chunk) */
+  column_vec   columns;    /* Vec : column, ordered like `types` iterates. */
+  hash_to_size column_lookup;  /* Map : hash(comp id) -> index_of(columns) */
+  int64_vec    cid_lookup;     /* Vec : g_cid -> index_of(columns) or -1 */
+  id_vec       row_entities;   /* Vec : row -> entt id */
 
-  /* entt_creation_buffer is filled when a system created new entities
-     concurrently. */
-  id_vec entt_creation_buffer; /* Vec : entt id */
+  /* The following members are made for concurrency and caching purposes. */
 
-  /* entt_deletion_buffer is filled when a system creates new entities
-     concurrently. */
-  id_vec entt_deletion_buffer; /* Vec : entt id */
+  /* Transitions out of this archetype are cached here the first time they are
+     taken. `edge_alias` remembers where adding or removing a set of types
+     leads so a repeated transition skips building the destination key. */
+  hash_to_edge edges;      /* Map : hash(Ordered[dest comp name]) -> edge */
+  id_to_hash   edge_alias; /* Map : delta key -> hash(Ordered[dest name]) */
 
-  /* Entities that have simulated operations over a tick are stored here. */
-  id_vec entt_mutation_buffer; /* Vec : entt id */
+  /* A list of addresses pointing to system_data structs existing in the g_core
+     struct. */
+  system_vec contenders; /* Vec : system_data, ordered by stage. */
 
-  /* dead_fragment_buffer is filled when a system transitions an entity off
-     this archetype. These fragments are collected and cleaned per tick. */
-  int64_vec dead_fragment_buffer; /* Vec : index_of(composite) */
+  /* Contenders are split into stages. Systems of a stage do not conflict
+     with each other, each stage starts after the previous one finished. */
+  int64_vec stage_ends; /* Vec : index_of(contenders) past each stage */
 
-  /* Concurrency properties */
-  pthread_t thread_id;
-  atomic_bool thread_in_process;
-  atomic_bool thread_complete;
+  int64_t emptied_at; /* The tick the archetype was found empty, 0 if not. */
 };
 
 struct g_par {
-  composite    *stored_components; /* Vector : fragment */
-  hash_to_size *component_offsets; /* Map : hash(comp id) -> gsize */
-  archetype    *arch;
-  g_core       *world;
-  int64_t       tick;
+  archetype   *arch; /* The fragment being processed. */
+  g_core      *world;
+  int64_t      tick;
+  system_data *system; /* The system processing it, NULL outside systems. */
+};
+
+struct g_field {
+  char   *base;    /* AoS/SoA: Address of the component of row 0. */
+  gsize   stride;  /* Bytes between the component of two neighbouring rows. */
+  char  **chunks;  /* CHUNKED: Chunk table of the fragment. */
+  gsize   offset;  /* CHUNKED: Byte offset of the column inside a chunk. */
+  int8_t  shift;   /* CHUNKED: log2(rows per chunk) */
+  bool    chunked;
 };
 
 struct g_pool {
@@ -138,15 +290,42 @@ struct g_pool {
   g_par  entities; /* Vector : any size */
 };
 
+struct g_view_itr {
+  matcher *view;
+  int64_t  match;    /* index_of(view->matches) of the next fragment. */
+  g_par    entities; /* The fragment being iterated. */
+  int64_t  start_at, stop_at; /* Rows of the current chunk. */
+};
+
 struct g_query {
-  g_core    *world_ctx;
-  archetype *archetype_ctx;
+  g_core      *world_ctx;
+  archetype   *archetype_ctx;
+  system_data *system_ctx;
+};
+
+struct matcher {
+  g_core     *world;
+  g_signature required; /* Bitset : [g_cid] every match holds */
+  g_signature excluded; /* Bitset : [g_cid] no match holds */
+  cache_vec   matches;  /* Vec : archetype, in the order they matched */
+  int64_t     system;   /* index_of(system_registry) or -1 */
 };
 
 struct system_data {
-  g_system start_system; /* A function pointer to a user defined function. */
-  type_set requirements; /* Set : [hash(comp name)] */
-  int32_t  readonly;
+  g_system    start_system; /* A function pointer to a user defined function. */
+  int64_t     id;           /* index_of(system_registry), registration order */
+  type_set    requirements; /* Set : [hash(comp name)] */
+  g_signature signature;    /* Bitset : [g_cid] of requirements */
+  g_signature reads;        /* Bitset : [g_cid] only read by the system */
+  g_signature writes;       /* Bitset : [g_cid] written by the system */
+
+  /* Blocks are only processed when every CHANGED component was written and
+     every ADDED component received since the system last ran. The copies
+     in `contenders` track `last_run` per archetype. */
+  g_signature changed;  /* Bitset : [g_cid] of CHANGED terms */
+  g_signature added;    /* Bitset : [g_cid] of ADDED terms */
+  bool        filtered; /* The query has CHANGED or ADDED terms. */
+  int64_t     last_run; /* The change tick of the last run. */
 };
 
 #endif
\ No newline at end of file
@@ -1,195 +1,609 @@
 #include <regex.h>
 
 #include "archetype.h"
+#include "chunk.h"
+#include "command.h"
+#include "component.h"
 #include "entity.h"
+#include "matcher.h"
+#include "signature.h"
 
 archetype empty_archetype = {0};
 
-void *boot_system(void *arg) {
-  void       **args = (void **)arg;
-  system_data *sys = args[0];
-  g_query     *query = args[1];
-  sys->start_system(query);
-  return NULL;
+/*-------------------------------------------------------
+ * Change Ticks
+ *-------------------------------------------------------*/
+int64_t archetype_next_tick(g_core *w) {
+  return atomic_fetch_add(&w->change_tick, 1) + 1;
 }
 
-void archetype_perform_process(g_core *w, archetype *process_arch) {
-  start_frame(process_arch->allocator);
+int64_t archetype_block_count(archetype *a) {
+  return a->layout == G_LAYOUT_CHUNKED ? a->chunks.length : 1;
+}
 
-  system_vec readonlys;
-  system_vec_sinit(&readonlys, process_arch->contenders.length);
+/* Systems writing through gq_get and gq_set may stamp the same block from
+   several threads at once. */
+static void stamp(int64_vec *ticks, int64_t block, int64_t tick) {
+  int64_t *at = int64_vec_at(ticks, block);
+  int64_t  seen = __atomic_load_n(at, __ATOMIC_RELAXED);
+  while (seen < tick &&
+         !__atomic_compare_exchange_n(at, &seen, tick, true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED))
+    ;
+}
 
-  for (int64_t i = 0; i < process_arch->contenders.length; i++) {
-    system_data *sys = system_vec_at(&process_arch->contenders, i);
-    if (sys->readonly != 0) {
-      system_vec_push(&readonlys, sys);
+void archetype_stamp_rows(archetype *from, int64_t *rows, archetype *to,
+                          int64_t dst, int64_t n, int64_t tick) {
+  if (n == 0) return;
+  int64_t first = archetype_block(to, dst);
+  int64_t last = archetype_block(to, dst + n - 1);
+
+  for (int64_t c = 0; c < to->columns.length; c++) {
+    column *col = column_vec_at(&to->columns, c);
+    if (!signature_has(&from->signature, col->id)) {
+      for (int64_t b = first; b <= last; b++) {
+        stamp(&col->added, b, tick);
+        stamp(&col->changed, b, tick);
+      }
       continue;
     }
-    sys->start_system(
-        &(g_query){.world_ctx = w, .archetype_ctx = process_arch});
-  }
 
-  if (readonlys.length == 0) return;
+    column *src = column_vec_at(
+        &from->columns, *int64_vec_at(&from->cid_lookup, col->id));
+    for (int64_t i = 0; i < n; i++) {
+      int64_t b = archetype_block(to, dst + i);
+      int64_t src_b = archetype_block(from, rows[i]);
+      stamp(&col->added, b, *int64_vec_at(&src->added, src_b));
+      stamp(&col->changed, b, *int64_vec_at(&src->changed, src_b));
+    }
+  }
+}
 
-  pthread_t *threads = stpush(readonlys.length * sizeof(pthread_t));
+void archetype_stamp_write(archetype *a, int64_t col, int64_t row,
+                           int64_t tick) {
+  stamp(&column_vec_at(&a->columns, col)->changed, archetype_block(a, row),
+        tick);
+}
 
-  for (int64_t i = 0; i < readonlys.length; i++) {
-    system_data *sys = system_vec_at(&readonlys, i);
-    g_query      q = {.world_ctx = w, .archetype_ctx = process_arch};
-    if (w->disable_concurrency == 1) {
-      sys->start_system(&q);
-    } else {
-      void **args = stpush(2 * sizeof(void *));
-      args[0] = sys;
-      args[1] = &q;
-      pthread_create(&threads[i], NULL, boot_system, args);
+/* Check if every component of 'filter' was received, when 'added' is set,
+   or written in block 'block' of 'a' after 'since'. */
+static bool block_newer(archetype *a, int64_t block, g_signature *filter,
+                        bool added, int64_t since) {
+  for (int64_t i = 0; i < G_SIGNATURE_WORDS; i++) {
+    for (uint64_t word = filter->words[i]; word; word &= word - 1) {
+      int64_t col =
+          *int64_vec_at(&a->cid_lookup, i * 64 + __builtin_ctzll(word));
+      column *c = column_vec_at(&a->columns, col);
+      int64_t *tick = int64_vec_at(added ? &c->added : &c->changed, block);
+      if (__atomic_load_n(tick, __ATOMIC_RELAXED) <= since) return false;
     }
   }
+  return true;
+}
+
+bool archetype_block_passes(archetype *a, int64_t block, system_data *sys) {
+  return block_newer(a, block, &sys->changed, false, sys->last_run) &&
+         block_newer(a, block, &sys->added, true, sys->last_run);
+}
 
-  if (w->disable_concurrency == 0) {
-    for (int64_t i = 0; i < readonlys.length; i++) {
-      if (pthread_join(threads[i], NULL)) {
-        log_debug("Thread unable to be joined");
-        exit(EXIT_FAILURE);
+/* Stamp the columns 'sys' writes in every block of 'a' it processed. */
+static void stamp_writes(archetype *a, system_data *sys, int64_t tick) {
+  g_signature written;
+  signature_and(&sys->writes, &a->signature, &written);
+
+  int64_t blocks = archetype_block_count(a);
+  for (int64_t b = 0; b < blocks; b++) {
+    if (sys->filtered && !archetype_block_passes(a, b, sys)) continue;
+    for (int64_t i = 0; i < G_SIGNATURE_WORDS; i++) {
+      for (uint64_t word = written.words[i]; word; word &= word - 1) {
+        int64_t col =
+            *int64_vec_at(&a->cid_lookup, i * 64 + __builtin_ctzll(word));
+        stamp(&column_vec_at(&a->columns, col)->changed, b, tick);
       }
     }
   }
-
-  end_frame(process_arch->allocator);
 }
 
-static void *thread_entry(void *args) {
-  archetype *arch = args;
+/* Run 'sys' over 'a'. Systems with CHANGED or ADDED terms are skipped when
+   no block of 'a' passes them. */
+static void run_system(g_core *w, archetype *a, system_data *sys) {
+  int64_t now = archetype_next_tick(w);
+  bool    run = !sys->filtered;
+  for (int64_t b = 0; !run && b < archetype_block_count(a); b++)
+    run = archetype_block_passes(a, b, sys);
+
+  if (run) {
+    sys->start_system(&(g_query){
+        .world_ctx = w, .archetype_ctx = a, .system_ctx = sys});
+    stamp_writes(a, sys, now);
+  }
+  sys->last_run = now;
+}
 
-  atomic_init(&arch->thread_in_process, false);
-  atomic_init(&arch->thread_complete, false);
+static void system_job(task *t) {
+  run_system(t->ctx[1], t->ctx[2], t->ctx[0]);
+}
 
-  while (true) {
-    bool to_process = atomic_load(&arch->thread_in_process);
-    if (to_process) {
-      atomic_store(&arch->thread_in_process, false);
+void archetype_perform_process(g_core *w, archetype *process_arch,
+                               task_group *tick_group) {
+  bool    concurrent = w->disable_concurrency == 0 && tick_group;
+  int64_t start = 0;
+  for (int64_t s = 0; s < process_arch->stage_ends.length; s++) {
+    int64_t end = *int64_vec_at(&process_arch->stage_ends, s);
+
+    /* The last stage is submitted into the ticks group so the whole tick
+       shares a single join barrier in `g_progress`. Earlier stages are
+       joined here before the next one may start. */
+    task_group  stage_group;
+    task_group *group = tick_group;
+    if (s != process_arch->stage_ends.length - 1) {
+      task_group_init(&stage_group);
+      group = &stage_group;
+    }
 
-      archetype_perform_process(arch->belongs_to, arch);
-      atomic_store(&arch->thread_complete, true);
+    /* This thread takes the first system of the stage itself. Commands of
+       one stage apply after those of the stages before it. */
+    if (concurrent) command_fence(w);
+    for (int64_t i = start + 1; concurrent && i < end; i++) {
+      system_data *sys = system_vec_at(&process_arch->contenders, i);
+      scheduler_submit(w->workers, &(task){.run = system_job,
+                                           .group = group,
+                                           .ctx = {sys, w, process_arch}});
     }
+    for (int64_t i = start; i < (concurrent ? start + 1 : end); i++)
+      run_system(w, process_arch,
+                 system_vec_at(&process_arch->contenders, i));
 
-    /* We check if parent thread wants us to close, and close */
-    pthread_testcancel();
+    if (concurrent && group == &stage_group) {
+      scheduler_wait(w->workers, &stage_group);
+      command_fence(w);
+    }
+    start = end;
   }
 }
 
-void subthread_archetype(archetype *a) {
-  pthread_create(&a->thread_id, NULL, thread_entry, a);
+static compare(by_registration, system_data, a, b, { return a.id < b.id; });
+
+/* Check if 'a' and 'b' may not run at the same time, one of them writes a
+   component the other one accesses. */
+static bool systems_conflict(system_data *a, system_data *b) {
+  return signature_intersects(&a->writes, &b->writes) ||
+         signature_intersects(&a->writes, &b->reads) ||
+         signature_intersects(&a->reads, &b->writes);
 }
-feach(add_new_offset, kvpair, type, {
+
+void archetype_schedule(archetype *a) {
+  int64_t n = a->contenders.length;
+  int64_vec_clear(&a->stage_ends);
+  if (n == 0) return;
+  system_vec_sort(&a->contenders, by_registration, NULL);
+
+  /* Every system lands one stage after the latest earlier system it
+     conflicts with, the dependency graph is walked in registration order */
+  start_frame(a->belongs_to->allocator);
+  int64_t     *stage = stpush(sizeof(int64_t) * n);
+  system_data *order = stpush(sizeof(system_data) * n);
+  int64_t      stages = 0;
+  for (int64_t i = 0; i < n; i++) {
+    stage[i] = 0;
+    for (int64_t j = 0; j < i; j++)
+      if (stage[j] >= stage[i] &&
+          systems_conflict(system_vec_at(&a->contenders, i),
+                           system_vec_at(&a->contenders, j)))
+        stage[i] = stage[j] + 1;
+    if (stage[i] + 1 > stages) stages = stage[i] + 1;
+  }
+
+  /* Reorder by stage, keeping registration order inside a stage */
+  int64_t pos = 0;
+  for (int64_t s = 0; s < stages; s++) {
+    for (int64_t i = 0; i < n; i++)
+      if (stage[i] == s) order[pos++] = *system_vec_at(&a->contenders, i);
+    int64_vec_push(&a->stage_ends, &pos);
+  }
+  memcpy(system_vec_at(&a->contenders, 0), order, sizeof(system_data) * n);
+  end_frame(a->belongs_to->allocator);
+}
+
+feach(add_new_column, kvpair, type, {
   void     **list = (void **)args;
   archetype *a = list[0];
   g_core    *w = list[1];
   gsize     *component_pos = list[2];
+  gsize     *row_align = list[3];
   gid       *type_name = type.key;
   gsize *type_size = id_to_size_get(&w->component_registry, type_name).value;
-  hash_to_size_put(&a->offsets, type_name, component_pos);
+
+  gsize col_idx = a->columns.length;
+  g_cid id = component_intern(*type_name);
+
+  /* Respect the declared alignment inside AoS rows */
+  gsize align = component_alignment(id);
+  *component_pos = (*component_pos + align - 1) / align * align;
+  if (align > *row_align) *row_align = align;
+
+  column_vec_push(&a->columns, &(column){.type = *type_name,
+                                         .id = id,
+                                         .size = *type_size,
+                                         .offset = *component_pos,
+                                         .data = NULL});
+  column *col = column_vec_top(&a->columns);
+  int64_vec_inita(&col->added, w->allocator, TO_HEAP, 4);
+  int64_vec_inita(&col->changed, w->allocator, TO_HEAP, 4);
+  hash_to_size_put(&a->column_lookup, type_name, &col_idx);
   *component_pos += *type_size;
+
+  signature_set(&a->signature, id);
+
+  /* Ids are dense so a flat table indexed by id replaces the hash lookup */
+  int64_t missing = -1;
+  while (a->cid_lookup.length <= id)
+    int64_vec_push(&a->cid_lookup, &missing);
+  *int64_vec_at(&a->cid_lookup, id) = col_idx;
 });
+/* Pick the largest power of two rows per chunk such that each column,
+   padded to COLUMN_ALIGNMENT, fits in G_CHUNK_SIZE. A power of two keeps
+   row lookups a shift and a mask. Returns false if not even one row fits. */
+static bool init_chunk_layout(archetype *a, gsize row_size) {
+  if (row_size == 0) return false;
+
+  int8_t shift = 0;
+  while (((gsize)2 << shift) * row_size <= G_CHUNK_SIZE)
+    shift++;
+
+  for (; shift >= 0; shift--) {
+    gsize rows = (gsize)1 << shift;
+    gsize chunk_pos = 0;
+    for (int64_t i = 0; i < a->columns.length; i++) {
+      column *col = column_vec_at(&a->columns, i);
+      col->chunk_offset = chunk_pos;
+      chunk_pos += rows * col->size;
+      chunk_pos = (chunk_pos + COLUMN_ALIGNMENT - 1) &
+                  ~(gsize)(COLUMN_ALIGNMENT - 1);
+    }
+    if (chunk_pos <= G_CHUNK_SIZE) {
+      a->chunk_shift = shift;
+      return true;
+    }
+  }
+
+  return false;
+}
+
 void init_archetype(g_core *w, archetype *a, hash_vec *key) {
   log_enter;
-  /* We only store the actual id value because the first bit is
-     meaningless. */
-  a->archetype_id = SELECT_ID(gid_atomic_incr(&w->id_gen));
+  a->archetype_id = atomic_fetch_add(&w->archetype_ids, 1) + 1;
   a->hash_name = hash_vector(key);
-  a->allocator = stalloc_create(256);
   log_debug("NEW ARCH KEY: %ld", a->hash_name);
 
+  /* Select the storage layout, per archetype overrides win over the world */
+  gsize *layout = hash_to_size_get(&w->layout_registry, &a->hash_name).value;
+  int8_t chosen = layout ? (int8_t)*layout : w->storage_layout;
+  a->layout = chosen & G_LAYOUT_MASK;
+  a->stable = (chosen & G_LAYOUT_STABLE) != 0;
+  a->length = 0;
+  a->capacity = 0;
+
   /* Init indexers and component containers */
-  hash_to_size_inita(&a->offsets, w->allocator, TO_HEAP, 16);
-  id_to_int64_inita(&a->entt_positions, w->allocator, TO_HEAP, 16);
+  hash_to_size_inita(&a->column_lookup, w->allocator, TO_HEAP, 16);
+  column_vec_inita(&a->columns, w->allocator, TO_HEAP, key->length);
+  int64_vec_inita(&a->cid_lookup, w->allocator, TO_HEAP, 16);
+  hash_to_edge_inita(&a->edges, w->allocator, TO_HEAP, 16);
+  id_to_hash_inita(&a->edge_alias, w->allocator, TO_HEAP, 16);
+  id_vec_inita(&a->row_entities, w->allocator, TO_HEAP, 16);
 
   /* Init system cache */
   system_vec_inita(&a->contenders, w->allocator, TO_HEAP, 16);
-
-  /* Init buffers */
-  id_vec_inita(&a->entt_creation_buffer, w->allocator, TO_HEAP, 16);
-  id_vec_inita(&a->entt_deletion_buffer, w->allocator, TO_HEAP, 16);
-  id_vec_inita(&a->entt_mutation_buffer, w->allocator, TO_HEAP, 16);
-  int64_vec_inita(&a->dead_fragment_buffer, w->allocator, TO_HEAP, 16);
+  int64_vec_inita(&a->stage_ends, w->allocator, TO_HEAP, 4);
 
   /* Apply type set */
   vec_to_set(key, &a->types);
 
-  /* Construct the offset table. Increment and collect the sizes of each type */
+  /* Construct the column table. Increment and collect the sizes of each type
+     so the AoS offsets come for free. */
   gsize component_pos = 0;
-  void *args[3];
+  gsize row_align = 1;
+  void *args[4];
   args[0] = a;
   args[1] = w;
   args[2] = &component_pos;
+  args[3] = &row_align;
 
-  map_foreach(&a->types.internals, add_new_offset, args);
+  map_foreach(&a->types.internals, add_new_column, args);
 
-  /* The lenghts of an element in the composite vector is equal to the final
-     position of 'component_pos' */
-  __vec_init(&a->components, component_pos, w->allocator, TO_HEAP, 16);
+  /* Pad the row so the next row starts aligned as well */
+  component_pos = (component_pos + row_align - 1) / row_align * row_align;
 
-  /* Caches don't get caches! Recursion base case here */
-  if (SELECT_MODE(atomic_load(&w->id_gen)) == CACHED) {
-    a->simulation = NULL;
-    log_leave;
-    return;
+  /* Rows too wide to fit in a chunk cannot be chunked, store them SoA */
+  if (a->layout == G_LAYOUT_CHUNKED && !init_chunk_layout(a, component_pos)) {
+    log_debug("Archetype rows exceed G_CHUNK_SIZE, falling back to SoA");
+    a->layout = G_LAYOUT_SOA;
+  }
+  if (a->layout == G_LAYOUT_CHUNKED) {
+    chunk_vec_inita(&a->chunks, w->allocator, TO_HEAP, 16);
+    a->chunk_src = &w->chunk_storage;
   }
 
-  /* Setup the archetypes simulation for non-concurrent properties */
-  a->simulation = g_create_world();
+  /* Other layouts are a single block, chunks add theirs as they come */
+  int64_t never = 0;
+  for (int64_t i = 0; a->layout != G_LAYOUT_CHUNKED && i < a->columns.length;
+       i++) {
+    int64_vec_push(&column_vec_at(&a->columns, i)->added, &never);
+    int64_vec_push(&column_vec_at(&a->columns, i)->changed, &never);
+  }
+
+  /* The lenghts of an element in the composite vector is equal to the final
+     position of 'component_pos'. SoA and chunked archetypes allocate on the
+     first push instead. */
+  if (a->layout == G_LAYOUT_AOS)
+    __vec_init(&a->components, component_pos, w->allocator, TO_HEAP, 16);
+
   a->belongs_to = w;
-  gid_atomic_set(&a->simulation->id_gen, CACHED);
-
-  /* Inside the simulation context, a transition can be triggered where there
-     are no archetypes inside the cache beforehand. This causes the archetype
-     being transitioned use GID = 0 for its ID when generating. This is a
-     huge problem because 0 represents the empty archetype. To fix this, we
-     simply increment before leaving the initialization step.
-
-     Also, to maintain entity ID consistency, entities will not use this
-     id_gen to create entities. This is only used for archetype indexing. */
-  gid_atomic_incr(&a->simulation->id_gen);
-
-  /* To retain the recursive properties of all functions being used, we
-     copy over the component registry data to the simulated world. */
-  id_to_size_free(&a->simulation->component_registry);
-  id_to_size_copy(&a->simulation->component_registry, &w->component_registry);
   log_leave;
 }
 
+archetype *archetype_lookup(g_core *w, uint64_t hash_name) {
+  archetype **arch =
+      hash_to_archetype_get(&w->archetype_registry, &hash_name).value;
+  return arch ? *arch : NULL;
+}
+
+/* Check if 'a' holds exactly the sorted types 'key'. Hashes only pick the
+   candidates, this decides. */
+static bool holds_key(archetype *a, hash_vec *key) {
+  int64_t distinct = 0;
+  for (int64_t i = 0; i < key->length; i++) {
+    gid *type = hash_vec_at(key, i);
+    if (i && *type == *hash_vec_at(key, i - 1)) continue;
+    if (!type_set_has(&a->types, type)) return false;
+    distinct++;
+  }
+  return distinct == type_set_length(&a->types);
+}
+
+/* The id archetypes take after 'probes' others with the key hash 'hash'. */
+static uint64_t probe_id(uint64_t hash, gsize probes) {
+  return hash + probes * REGISTRY_PROBE_STEP;
+}
+
+archetype *archetype_find(g_core *w, hash_vec *key) {
+  uint64_t   hash = hash_vector(key);
+  archetype *a = archetype_lookup(w, hash);
+  if (a && holds_key(a, key)) return a;
+
+  /* Ids past the hash are only in use when it collided before */
+  gsize *probes = hash_to_size_get(&w->registry_probes, &hash).value;
+  for (gsize i = 1; probes && i <= *probes; i++) {
+    a = archetype_lookup(w, probe_id(hash, i));
+    if (a && holds_key(a, key)) return a;
+  }
+  return NULL;
+}
+
+/* Find an unused id for an archetype whose key hashes to 'hash'. */
+static uint64_t claim_id(g_core *w, uint64_t hash) {
+  if (!archetype_lookup(w, hash)) return hash;
+
+  gsize *known = hash_to_size_get(&w->registry_probes, &hash).value;
+  gsize  probes = known ? *known : 0;
+  for (gsize i = 1; i <= probes; i++)
+    if (!archetype_lookup(w, probe_id(hash, i))) return probe_id(hash, i);
+
+  log_debug("ARCH KEY COLLISION: %ld", hash);
+  do probes++;
+  while (archetype_lookup(w, probe_id(hash, probes)));
+  hash_to_size_del(&w->registry_probes, &hash);
+  hash_to_size_put(&w->registry_probes, &hash, &probes);
+  return probe_id(hash, probes);
+}
+
+feach(free_edge, kvpair, item, {
+  archetype_edge *e = item.value;
+  copy_plan_free(&e->plan);
+});
 void free_archetype(archetype *a) {
   log_enter;
   assert(a);
 
+  hash_to_edge_foreach(&a->edges, free_edge, NULL);
+  hash_to_edge_free(&a->edges);
+  id_to_hash_free(&a->edge_alias);
+
   type_set_free(&a->types);
-  vec_free(&a->components);
-  hash_to_size_free(&a->offsets);
-  id_to_int64_free(&a->entt_positions);
-  stalloc_free(a->allocator);
+  if (a->layout == G_LAYOUT_AOS) vec_free(&a->components);
+  if (a->layout == G_LAYOUT_CHUNKED) {
+    archetype_truncate(a, 0);
+    chunk_vec_free(&a->chunks);
+  }
+  for (int64_t i = 0; i < a->columns.length; i++) {
+    column *col = column_vec_at(&a->columns, i);
+    free(col->data);
+    int64_vec_free(&col->added);
+    int64_vec_free(&col->changed);
+  }
+  column_vec_free(&a->columns);
+  int64_vec_free(&a->cid_lookup);
+  hash_to_size_free(&a->column_lookup);
+  id_vec_free(&a->row_entities);
 
   system_vec_free(&a->contenders);
+  int64_vec_free(&a->stage_ends);
 
-  id_vec_free(&a->entt_creation_buffer);
-  id_vec_free(&a->entt_deletion_buffer);
-  id_vec_free(&a->entt_mutation_buffer);
-  int64_vec_free(&a->dead_fragment_buffer);
+  log_leave;
+};
 
-  if (a->simulation) g_destroy_world(a->simulation);
+/*-------------------------------------------------------
+ * Storage Operations
+ *-------------------------------------------------------*/
+/* Grow every column of the SoA archetype 'a' to hold at least 'rows'. */
+static void grow_columns(archetype *a, int64_t rows) {
+  int64_t capacity = a->capacity ? a->capacity : 16;
+  while (capacity < rows)
+    capacity *= 2;
+
+  for (int64_t i = 0; i < a->columns.length; i++) {
+    column *col = column_vec_at(&a->columns, i);
+
+    /* aligned_alloc requires the size to be a multiple of the alignment */
+    gsize bytes = capacity * col->size;
+    bytes = (bytes + COLUMN_ALIGNMENT - 1) & ~(gsize)(COLUMN_ALIGNMENT - 1);
+
+    void *data = aligned_alloc(COLUMN_ALIGNMENT, bytes);
+    assert(data && "Unable to allocate column!");
+    if (col->data) memcpy(data, col->data, a->length * col->size);
+    free(col->data);
+    col->data = data;
+  }
+
+  a->capacity = capacity;
+}
+
+int64_t archetype_push_row(archetype *a, gid entt) {
+  return archetype_push_rows(a, &entt, 1);
+}
 
-  if (!a->belongs_to->disable_concurrency) {
-    /* Request the thread to cancel, this should be guarentee'd */
-    pthread_cancel(a->thread_id);
-    if (pthread_join(a->thread_id, NULL)) {
-      log_debug("Thread unable to be joined/closed");
-      exit(EXIT_FAILURE);
+int64_t archetype_push_rows(archetype *a, gid *entts, int64_t n) {
+  int64_t row = a->length;
+  if (n == 0) return row;
+  for (int64_t i = 0; i < n; i++)
+    id_vec_push(&a->row_entities, &entts[i]);
+
+  if (a->layout == G_LAYOUT_AOS) {
+    composite_resize(&a->components, row + n);
+    memset(composite_at(&a->components, row), 0,
+           n * a->components.__el_size);
+    a->length += n;
+    return row;
+  }
+
+  if (a->layout == G_LAYOUT_SOA) {
+    if (row + n > a->capacity) grow_columns(a, row + n);
+    for (int64_t i = 0; i < a->columns.length; i++) {
+      column *col = column_vec_at(&a->columns, i);
+      memset((char *)col->data + row * col->size, 0, n * col->size);
     }
+    a->length += n;
+    return row;
   }
 
-  log_leave;
-};
+  /* Chunked storage only grows by whole chunks, existing rows never move */
+  int64_t never = 0;
+  while (row + n > (int64_t)a->chunks.length << a->chunk_shift) {
+    void *chunk = chunk_acquire(a->chunk_src);
+    chunk_vec_push(&a->chunks, &chunk);
+    for (int64_t i = 0; i < a->columns.length; i++) {
+      int64_vec_push(&column_vec_at(&a->columns, i)->added, &never);
+      int64_vec_push(&column_vec_at(&a->columns, i)->changed, &never);
+    }
+  }
+
+  a->length += n;
+  for (int64_t r = row; r < row + n; r++) {
+    for (int64_t i = 0; i < a->columns.length; i++)
+      memset(archetype_field(a, r, i), 0,
+             column_vec_at(&a->columns, i)->size);
+  }
+  return row;
+}
+
+int64_t archetype_column(archetype *a, gid type) {
+  gsize *col_idx = hash_to_size_get(&a->column_lookup, &type).value;
+  return col_idx ? (int64_t)*col_idx : -1;
+}
+
+void *archetype_field(archetype *a, int64_t row, int64_t col_idx) {
+  column *col = column_vec_at(&a->columns, col_idx);
+  if (a->layout == G_LAYOUT_SOA) return (char *)col->data + row * col->size;
+  if (a->layout == G_LAYOUT_CHUNKED) {
+    char   *chunk = *chunk_vec_at(&a->chunks, row >> a->chunk_shift);
+    int64_t slot = row & (((int64_t)1 << a->chunk_shift) - 1);
+    return chunk + col->chunk_offset + slot * col->size;
+  }
+  return (char *)composite_at(&a->components, row) + col->offset;
+}
+
+void archetype_move_row(archetype *a, int64_t dst, int64_t src) {
+  if (dst == src) return;
+
+  /* The row brings its ticks along when it changes block */
+  int64_t src_block = archetype_block(a, src);
+  int64_t dst_block = archetype_block(a, dst);
+  for (int64_t i = 0; src_block != dst_block && i < a->columns.length; i++) {
+    column *col = column_vec_at(&a->columns, i);
+    archetype_stamp_write(a, i, dst, *int64_vec_at(&col->changed, src_block));
+    int64_t *added = int64_vec_at(&col->added, dst_block);
+    int64_t  moved = *int64_vec_at(&col->added, src_block);
+    if (*added < moved) *added = moved;
+  }
+
+  if (a->layout == G_LAYOUT_AOS) {
+    memmove(composite_at(&a->components, dst),
+            composite_at(&a->components, src), a->components.__el_size);
+    return;
+  }
+
+  for (int64_t i = 0; i < a->columns.length; i++) {
+    memmove(archetype_field(a, dst, i), archetype_field(a, src, i),
+            column_vec_at(&a->columns, i)->size);
+  }
+}
 
-static compare(sort_hashes, int64_t, a, b, { return a < b; });
+/* Shift the rows behind the ascending 'rows' down over them, keeping their
+   order, and update the positions of the entities that moved. */
+static void compact_rows(archetype *a, int64_t *rows, int64_t n) {
+  int64_t kept = rows[0];
+  for (int64_t src = rows[0], i = 0; src < a->length; src++) {
+    if (i < n && rows[i] == src) {
+      i++;
+      continue;
+    }
+    archetype_move_row(a, kept, src);
+    gid moved = *id_vec_at(&a->row_entities, src);
+    *id_vec_at(&a->row_entities, kept) = moved;
+    entity_lookup(&a->belongs_to->entity_registry, moved)->row = kept;
+    kept++;
+  }
+  archetype_truncate(a, kept);
+}
+
+void archetype_remove_row(archetype *a, int64_t row) {
+  assert(row < a->length && "Row does not exist!");
+  if (a->stable) return compact_rows(a, &row, 1);
+
+  /* Fill the hole with the last row so the fragment stays dense */
+  int64_t last = a->length - 1;
+  if (row != last) {
+    archetype_move_row(a, row, last);
+    gid moved = *id_vec_at(&a->row_entities, last);
+    *id_vec_at(&a->row_entities, row) = moved;
+    entity_lookup(&a->belongs_to->entity_registry, moved)->row = row;
+  }
+
+  archetype_truncate(a, last);
+}
+
+void archetype_truncate(archetype *a, int64_t length) {
+  assert(length <= a->length && "Archetypes can only be truncated!");
+  while (a->row_entities.length > length)
+    id_vec_pop(&a->row_entities);
+  if (a->layout == G_LAYOUT_AOS) composite_resize(&a->components, length);
+  a->length = length;
+
+  /* Chunks that no longer hold any row go back to the pool */
+  if (a->layout != G_LAYOUT_CHUNKED) return;
+  int64_t rows = (int64_t)1 << a->chunk_shift;
+  int64_t keep = (length + rows - 1) / rows;
+  while (a->chunks.length > keep) {
+    chunk_release(a->chunk_src, *chunk_vec_top(&a->chunks));
+    chunk_vec_pop(&a->chunks);
+    for (int64_t i = 0; i < a->columns.length; i++) {
+      int64_vec_pop(&column_vec_at(&a->columns, i)->added);
+      int64_vec_pop(&column_vec_at(&a->columns, i)->changed);
+    }
+  }
+}
+
+static compare(sort_hashes, gid, a, b, { return a < b; });
 void archetype_key(char *types, hash_vec *hashes) {
   log_enter;
   assert(types);
@@ -219,7 +633,7 @@ void archetype_key(char *types, hash_vec *hashes) {
     }
 
     if (*types == ',') {
-      gid comp_id = (gid)hash_bytes(origin + start_pos, end_pos - start_pos);
+      gid comp_id = (gid)hash_mem(origin + start_pos, end_pos - start_pos);
       hash_vec_push(hashes, &comp_id);
       start_pos = end_pos + 1;
     }
@@ -228,7 +642,7 @@ void archetype_key(char *types, hash_vec *hashes) {
   }
 
   if (start_pos != end_pos) {
-    gid comp_id = (gid)hash_bytes(origin + start_pos, end_pos - start_pos);
+    gid comp_id = (gid)hash_mem(origin + start_pos, end_pos - start_pos);
     hash_vec_push(hashes, &comp_id);
   }
 
@@ -249,7 +663,7 @@ void archetype_key(char *types, hash_vec *hashes) {
 
     if (arg_start == -1 || arg_end == -1) break;
 
-    gid comp_id = (gid)hash_bytes(&cursor[arg_start], arg_end - arg_start);
+    gid comp_id = (gid)hash_mem(&cursor[arg_start], arg_end - arg_start);
 
     /* We sort after all are pushed */
     hash_vec_push(hashes, &comp_id);
@@ -260,121 +674,321 @@ void archetype_key(char *types, hash_vec *hashes) {
   log_leave;
 }
 
-feach(migrate_segments, kvpair, item, {
-  void     **list = (void **)args;
-  void      *prev_seg = list[0];
-  void      *next_seg = list[1];
-  g_core    *w = list[2];
-  archetype *prev = list[3];
-  archetype *next = list[4];
+/* Collect the components both archetypes share into copy runs. Components
+   that sit next to each other in both AoS rows are merged into one run. */
+static void build_copy_plan(g_core *w, archetype *from, archetype *to,
+                            archetype_edge *e) {
+  e->to = to;
+  e->packed = from->layout == G_LAYOUT_AOS && to->layout == G_LAYOUT_AOS;
+  copy_plan_inita(&e->plan, w->allocator, TO_HEAP, to->columns.length);
+
+  for (int64_t i = 0; i < to->columns.length; i++) {
+    column *dst = column_vec_at(&to->columns, i);
+    if (!signature_has(&from->signature, dst->id)) continue;
+
+    int64_t src_col = *int64_vec_at(&from->cid_lookup, dst->id);
+    column *src = column_vec_at(&from->columns, src_col);
+
+    copy_run *last = e->plan.length ? copy_plan_top(&e->plan) : NULL;
+    if (e->packed && last && last->src_off + last->size == src->offset &&
+        last->dst_off + last->size == dst->offset) {
+      last->size += dst->size;
+      continue;
+    }
 
-  uint64_t *type = item.key;
+    copy_plan_push(&e->plan, &(copy_run){.src_col = src_col,
+                                         .dst_col = i,
+                                         .src_off = src->offset,
+                                         .dst_off = dst->offset,
+                                         .size = dst->size});
+  }
+}
 
-  log_debug("adding type: %ld", *type);
+archetype_edge *archetype_find_edge(g_core *w, archetype *from,
+                                    archetype *to) {
+  archetype_edge *e = hash_to_edge_get(&from->edges, &to->hash_name).value;
+  if (e) return e;
 
-  gsize *component_size = hash_to_size_get(&w->component_registry, type).value;
-  gsize *prev_offset = hash_to_size_get(&prev->offsets, type).value;
-  gsize *next_offset = hash_to_size_get(&next->offsets, type).value;
+  archetype_edge edge = {0};
+  build_copy_plan(w, from, to, &edge);
+  hash_to_edge_put(&from->edges, &to->hash_name, &edge);
+  return hash_to_edge_get(&from->edges, &to->hash_name).value;
+}
+
+static void apply_copy_plan(archetype_edge *e, archetype *from, int64_t src_row,
+                            int64_t dst_row) {
+  archetype *to = e->to;
+
+  if (e->packed) {
+    char *src = (char *)composite_at(&from->components, src_row);
+    char *dst = (char *)composite_at(&to->components, dst_row);
+    for (int64_t i = 0; i < e->plan.length; i++) {
+      copy_run *run = copy_plan_at(&e->plan, i);
+      memcpy(dst + run->dst_off, src + run->src_off, run->size);
+    }
+    return;
+  }
+
+  for (int64_t i = 0; i < e->plan.length; i++) {
+    copy_run *run = copy_plan_at(&e->plan, i);
+    memcpy(archetype_field(to, dst_row, run->dst_col),
+           archetype_field(from, src_row, run->src_col), run->size);
+  }
+}
+
+/* Move 'entt' from 'from' to 'to', carrying over every component both share.
+   The row left behind is filled by the last row of 'from' right away. */
+static void move_entity(g_core *w, gid entt, archetype *from, archetype *to) {
+  if (from == to) return;
+
+  entity_record *rec = entity_lookup(&w->entity_registry, entt);
+  assert(rec && "Invalid Entity ID!");
+
+  /* Add one more space for the incomming entity to this archetype. */
+  int64_t pos = archetype_push_row(to, entt);
+  archetype_stamp_rows(from, &rec->row, to, pos, 1, archetype_next_tick(w));
+
+  /* The empty archetype has no data, nothing needs to be copied. Removing
+     the old row may move another entity, its record is patched in place. */
+  if (from != &empty_archetype) {
+    apply_copy_plan(archetype_find_edge(w, from, to), from, rec->row, pos);
+    archetype_remove_row(from, rec->row);
+  }
+
+  rec->arch = to;
+  rec->row = pos;
+}
+
+void archetype_copy_rows(archetype_edge *e, archetype *from, int64_t *rows,
+                         int64_t dst, int64_t n) {
+  archetype *to = e->to;
+  bool       contiguous = rows[n - 1] - rows[0] == n - 1;
+
+  for (int64_t r = 0; r < e->plan.length; r++) {
+    copy_run *run = copy_plan_at(&e->plan, r);
+
+    /* Column to column, the whole range moves with one copy */
+    if (contiguous && from->layout == G_LAYOUT_SOA &&
+        to->layout == G_LAYOUT_SOA) {
+      memcpy(archetype_field(to, dst, run->dst_col),
+             archetype_field(from, rows[0], run->src_col), n * run->size);
+      continue;
+    }
+
+    for (int64_t i = 0; i < n; i++)
+      memcpy(archetype_field(to, dst + i, run->dst_col),
+             archetype_field(from, rows[i], run->src_col), run->size);
+  }
+}
+
+void archetype_remove_rows(archetype *a, int64_t *rows, int64_t n) {
+  if (n == 0) return;
+
+  /* A range at the end is dropped at once. Otherwise remove from the back
+     so no row left to remove is moved by the swap. */
+  if (rows[n - 1] - rows[0] == n - 1 && rows[n - 1] == a->length - 1) {
+    archetype_truncate(a, rows[0]);
+    return;
+  }
+  if (a->stable) return compact_rows(a, rows, n);
+  for (int64_t i = n - 1; i >= 0; i--)
+    archetype_remove_row(a, rows[i]);
+}
+
+void archetype_move_rows(g_core *w, archetype *from, archetype *to,
+                         gid *entts, int64_t *rows, int64_t n) {
+  if (from == to || n == 0) return;
+
+  int64_t dst = archetype_push_rows(to, entts, n);
+  archetype_stamp_rows(from, rows, to, dst, n, archetype_next_tick(w));
+
+  if (from != &empty_archetype) {
+    archetype_copy_rows(archetype_find_edge(w, from, to), from, rows, dst, n);
+    archetype_remove_rows(from, rows, n);
+  }
+
+  for (int64_t i = 0; i < n; i++) {
+    entity_record *rec = entity_lookup(&w->entity_registry, entts[i]);
+    rec->arch = to;
+    rec->row = dst + i;
+  }
+}
+
+archetype *archetype_resolve(g_core *w, hash_vec *key) {
+  /* Check if there already exists an archetype with this key. If not, make
+     it. Since the key is known to be ordered, its hash is the same. */
+  archetype *a_next = archetype_find(w, key);
+  if (!a_next) a_next = archetype_revive(w, key);
+  if (!a_next) {
+    /* Make new archetype */
+    a_next = calloc(1, sizeof(*a_next));
+    init_archetype(w, a_next, key);
+    a_next->hash_name = claim_id(w, a_next->hash_name);
+
+    /* Add the world, only the matchers that may accept the new archetype
+       are tested against it. */
+    hash_to_archetype_put(&w->archetype_registry, &a_next->hash_name,
+                          &a_next);
+    matchers_add_archetype(w, a_next);
+  }
+
+  return a_next;
+}
 
-  memmove(next_seg + *next_offset, prev_seg + *prev_offset, *component_size);
-});
 void delta_transition(g_core *w, gid entt, hash_vec *to_key) {
   log_enter;
-  archetype *a_next, *a_prev;
-  kvpair     kv;
+  move_entity(w, entt, load_entity_archetype(w, entt),
+              archetype_resolve(w, to_key));
+  log_leave;
+}
 
-  /* Load the current state of the archetype on the FSM */
-  a_prev = load_entity_archetype(w, entt);
+archetype *edge_follow(g_core *w, archetype *from, hash_vec *delta,
+                       bool add) {
+  if (from == &empty_archetype) return NULL;
+
+  uint64_t  delta_key = add ? EDGE_ADD_KEY(delta) : EDGE_REM_KEY(delta);
+  uint64_t *to = id_to_hash_get(&from->edge_alias, &delta_key).value;
+  if (!to) return NULL;
+  archetype *a_next = archetype_lookup(w, *to);
+  if (!a_next) return NULL;
+
+  /* Delta keys are hashes too. The alias is only taken if 'to' holds
+     exactly the components of 'from' plus or minus 'delta'. The components
+     of 'delta' are found in the archetype that has them, removing one
+     'from' lacks changes nothing. */
+  archetype  *has = add ? a_next : from;
+  g_signature changed = {0};
+  for (int64_t i = 0; i < delta->length; i++) {
+    int64_t col = archetype_column(has, *hash_vec_at(delta, i));
+    if (col == -1) {
+      if (add) return NULL;
+      continue;
+    }
+    signature_set(&changed, column_vec_at(&has->columns, col)->id);
+  }
 
-  /* We generate the archetype id by hashing the key. Since the vector is known
-     to be ordered, the hashes will be the same.  */
-  uint64_t arch_id = hash_vector(to_key);
+  g_signature expected;
+  if (add) signature_or(&from->signature, &changed, &expected);
+  else signature_andnot(&from->signature, &changed, &expected);
+  return signature_equals(&expected, &a_next->signature) ? a_next : NULL;
+}
 
-  /* Check if there already exists an archetype with this id. If not, make it */
-  if (!id_to_archetype_has(&w->archetype_registry, &arch_id)) {
-    /* Make new archetype */
-    archetype a = {0};
-    init_archetype(w, &a, to_key);
-
-    /* Add the world, a new archetype appearing causes the FSM process to
-       retrigger. */
-    hash_to_archetype_put(&w->archetype_registry, &arch_id, &a);
-    a_next = hash_to_archetype_get(&w->archetype_registry, &arch_id).value;
-    if (!w->disable_concurrency) subthread_archetype(a_next);
-    w->invalidate_fsm = 1;
-  } else {
-    /* Load the archetype to transition to */
-    a_next = hash_to_archetype_get(&w->archetype_registry, &arch_id).value;
-  }
-
-  /* Load the archetype of the current entity */
-  kv = id_to_hash_get(&w->entity_registry, &entt);
-  assert(kv.value && "Invalid Entity ID!");
-
-  /* Case 1: a_prev is the empty archetype. We don't need to do anything other
-             than move the entity to a_next. No copying is necessary. */
-  if (a_prev == &empty_archetype) {
-    /* Add one more space for the incomming entity to this archetype. */
-    int64_t pos = a_next->components.length;
-    vec_resize(&a_next->components, a_next->components.length + 1);
-    memset(composite_at(&a_next->components, pos), 0,
-           a_next->components.__el_size);
-
-    /* Add the position to entity map for easy id lookup */
-    id_to_int64_put(&a_next->entt_positions, &entt, &pos);
-
-    /* Update the world entity registry for global entity access */
-    // TODO: make it so that put does overwrites so we dont need to delete
-    id_to_hash_del(&w->entity_registry, &entt);
-    id_to_hash_put(&w->entity_registry, &entt, &arch_id);
-    log_leave;
-    return;
+bool edge_transition(g_core *w, gid entt, hash_vec *delta, bool add) {
+  archetype *a_prev = load_entity_archetype(w, entt);
+  archetype *a_next = edge_follow(w, a_prev, delta, add);
+  if (!a_next) return false;
+
+  move_entity(w, entt, a_prev, a_next);
+  return true;
+}
+
+void edge_remember(archetype *from, uint64_t delta_key, archetype *to) {
+  if (from == &empty_archetype) return;
+  id_to_hash_put(&from->edge_alias, &delta_key, &to->hash_name);
+}
+
+/*-------------------------------------------------------
+ * Retirement
+ *-------------------------------------------------------*/
+/* Give the row storage of the empty archetype 'a' back. Chunks already went
+   back to the pool when the last row left. */
+static void release_storage(g_core *w, archetype *a) {
+  id_vec_free(&a->row_entities);
+  id_vec_inita(&a->row_entities, w->allocator, TO_HEAP, 16);
+
+  if (a->layout == G_LAYOUT_AOS) {
+    gsize row_size = a->components.__el_size;
+    vec_free(&a->components);
+    __vec_init(&a->components, row_size, w->allocator, TO_HEAP, 16);
+  }
+
+  for (int64_t i = 0; i < a->columns.length; i++) {
+    column *col = column_vec_at(&a->columns, i);
+    free(col->data);
+    col->data = NULL;
+
+    /* Systems matching the archetype again start from scratch */
+    if (a->layout != G_LAYOUT_CHUNKED) {
+      *int64_vec_at(&col->added, 0) = 0;
+      *int64_vec_at(&col->changed, 0) = 0;
+    }
+  }
+  a->capacity = 0;
+}
+
+feach(collect_aliases_into, kvpair, item, {
+  void **list = (void **)args;
+  if (*(uint64_t *)item.value == *(uint64_t *)list[0])
+    hash_vec_push(list[1], item.key);
+});
+feach(drop_edges_into, kvpair, item, {
+  archetype      *from = *(archetype **)item.value;
+  uint64_t       *hash_name = args;
+  archetype_edge *e = hash_to_edge_get(&from->edges, hash_name).value;
+  if (e) {
+    copy_plan_free(&e->plan);
+    hash_to_edge_del(&from->edges, hash_name);
   }
 
-  /* Case 2: a_prev is not the empty archetype. In this case, we need to
-             transition component data that we care about and discard the
-             rest. We do this by collecting the intersection between the
-             new and old types. */
-
-  /* Prepare to load the previous segment */
-  kv = id_to_int64_get(&a_prev->entt_positions, &entt);
-  assert(kv.value && "Invalid Entity ID!");
-  int64_t prev_pos = *(int *)kv.value;
-
-  /* Prepare to load the next/new segement */
-  int64_t pos = a_next->components.length;
-  composite_resize(&a_next->components, a_next->components.length + 1);
-  memset(composite_at(&a_next->components, pos), 0,
-         a_next->components.__el_size);
-
-  /* Load prev and next segments */
-  void *prev_seg = composite_at(&a_prev->components, prev_pos);
-  void *next_seg = composite_at(&a_next->components, pos);
-
-  type_set retained_types;
-  int32_t  old_flags = a_prev->types.internals.flags;
-  a_prev->types.internals.flags = TO_STACK;
-  type_set_intersect(&a_prev->types, &a_next->types, &retained_types);
-  a_prev->types.internals.flags = old_flags;
-
-  /* Migrate the retained types to a_next */
-  // TODO: implement some type of iterator in sets because this:
-  void *args[5];
-  args[0] = prev_seg;
-  args[1] = next_seg;
-  args[2] = w;
-  args[3] = a_prev;
-  args[4] = a_next;
-  map_foreach(&retained_types.internals, migrate_segments, args);
-
-  /* Cleanup reminants of the entity that was transitioned. */
-  id_to_int64_del(&a_prev->entt_positions, &entt);
-  id_to_int64_put(&a_next->entt_positions, &entt, &pos);
-  id_to_hash_del(&w->entity_registry, &entt);
-  id_to_hash_put(&w->entity_registry, &entt, &arch_id);
-
-  /* Instead of deleting the composite vector now, we delete at the end of the
-     tick as a batch process */
-  int64_vec_push(&a_prev->dead_fragment_buffer, &prev_pos);
+  /* Its id may be claimed by another archetype later on */
+  hash_vec stale;
+  hash_vec_sinit(&stale, 4);
+  void *list[2];
+  list[0] = hash_name;
+  list[1] = &stale;
+  id_to_hash_foreach(&from->edge_alias, collect_aliases_into, list);
+  for (int64_t i = 0; i < stale.length; i++)
+    id_to_hash_del(&from->edge_alias, hash_vec_at(&stale, i));
+});
+void archetype_retire(g_core *w, archetype *a) {
+  log_enter;
+  assert(a->length == 0 && "Only empty archetypes can be retired!");
+  log_debug("RETIRE ARCH KEY: %ld", a->hash_name);
+
+  hash_to_archetype_del(&w->archetype_registry, &a->hash_name);
+  matchers_remove_archetype(w, a);
+
+  /* Edges and aliases into the archetype are dropped */
+  hash_to_archetype_foreach(&w->archetype_registry, drop_edges_into,
+                            &a->hash_name);
+  hash_to_edge_foreach(&a->edges, free_edge, NULL);
+  hash_to_edge_free(&a->edges);
+  hash_to_edge_inita(&a->edges, w->allocator, TO_HEAP, 16);
+  id_to_hash_free(&a->edge_alias);
+  id_to_hash_inita(&a->edge_alias, w->allocator, TO_HEAP, 16);
+
+  release_storage(w, a);
+  /* The pool is bounded, the archetype retired the longest ago goes */
+  cache_vec *pool = &w->retired_archetypes;
+  if (pool->length == ARCHETYPE_POOL_SIZE) {
+    archetype *oldest = *cache_vec_at(pool, 0);
+    for (int64_t i = 1; i < pool->length; i++)
+      *cache_vec_at(pool, i - 1) = *cache_vec_at(pool, i);
+    cache_vec_pop(pool);
+    free_archetype(oldest);
+    free(oldest);
+  }
+  cache_vec_push(pool, (void **)&a);
   log_leave;
-}
\ No newline at end of file
+}
+
+archetype *archetype_revive(g_core *w, hash_vec *key) {
+  cache_vec *pool = &w->retired_archetypes;
+  for (int64_t i = 0; i < pool->length; i++) {
+    archetype *a = *cache_vec_at(pool, i);
+    if (!holds_key(a, key)) continue;
+
+    /* The pool stays ordered by retirement for eviction */
+    for (int64_t j = i + 1; j < pool->length; j++)
+      *cache_vec_at(pool, j - 1) = *cache_vec_at(pool, j);
+    cache_vec_pop(pool);
+    a->emptied_at = 0;
+
+    /* Its old id may have been claimed by a colliding key meanwhile */
+    a->hash_name = claim_id(w, hash_vector(key));
+    hash_to_archetype_put(&w->archetype_registry, &a->hash_name, &a);
+    matchers_add_archetype(w, a);
+    return a;
+  }
+  return NULL;
+}
@@ -12,6 +12,7 @@
 #include "gecs.h"
 #include "gid.h"
 #include "logger.h"
+#include "scheduler.h"
 #include "str_utils.h"
 
 /* We define the empty archetype to be an arbitrary unique address containing
@@ -22,22 +23,140 @@ extern archetype empty_archetype;
    and types 'types'. */
 void init_archetype(g_core *w, archetype *a, hash_vec *types);
 
+/* Find the archetype with the id 'hash_name' in 'w'. Returns NULL if no
+   archetype has it. */
+archetype *archetype_lookup(g_core *w, uint64_t hash_name);
+
+/* Find the archetype of 'w' holding exactly the sorted types 'key'. Returns
+   NULL if it does not exist or is retired. */
+archetype *archetype_find(g_core *w, hash_vec *key);
+
 /* Free's archetype a */
 void free_archetype(archetype *a);
 
+/* Take the empty archetype 'a' out of 'w'. Its storage, edges and matches are
+   released and it waits in the retired pool of 'w' until it is revived or
+   pushed out. */
+void archetype_retire(g_core *w, archetype *a);
+
+/* Bring the retired archetype with the sorted types 'key' back into 'w'.
+   Returns NULL if it is not in the pool. */
+archetype *archetype_revive(g_core *w, hash_vec *key);
+
+/* Append a zeroed row owned by 'entt' to the storage of 'a' and return its
+   index. */
+int64_t archetype_push_row(archetype *a, gid entt);
+
+/* Append 'n' zeroed rows owned by 'entts' to the storage of 'a', growing it
+   at most once, and return the index of the first one. */
+int64_t archetype_push_rows(archetype *a, gid *entts, int64_t n);
+
+/* Index of the column storing 'type' inside 'a'. Returns -1 if 'a' does not
+   contain 'type'. */
+int64_t archetype_column(archetype *a, gid type);
+
+/* Address of the component in column 'col' for row 'row' of 'a'. Works for
+   every storage layout. */
+void *archetype_field(archetype *a, int64_t row, int64_t col);
+
+/* Overwrite row 'dst' of 'a' with the components of row 'src'. */
+void archetype_move_row(archetype *a, int64_t dst, int64_t src);
+
+/* Remove row 'row' of 'a' by moving the last row into its place, or by
+   shifting every row behind it down when 'a' is stable. The moved entities'
+   positions are updated, the removed entity's position is not. */
+void archetype_remove_row(archetype *a, int64_t row);
+
+/* Shrink 'a' to only contain its first 'length' rows. */
+void archetype_truncate(archetype *a, int64_t length);
+
+/* Hand out the next change tick of 'w'. Thread safe. */
+int64_t archetype_next_tick(g_core *w);
+
+/* The block of 'a' holding 'row'. Change ticks are kept per block, see
+   `column`. */
+static inline int64_t archetype_block(archetype *a, int64_t row) {
+  return a->layout == G_LAYOUT_CHUNKED ? row >> a->chunk_shift : 0;
+}
+
+/* The amount of blocks 'a' is split into. */
+int64_t archetype_block_count(archetype *a);
+
+/* Stamp the 'n' rows of 'to' starting at 'dst' as filled at change tick
+   'tick'. Components carried over from the ascending 'rows' of 'from' keep
+   their ticks, the others count as added. Pass the empty archetype as
+   'from' for new entities. */
+void archetype_stamp_rows(archetype *from, int64_t *rows, archetype *to,
+                          int64_t dst, int64_t n, int64_t tick);
+
+/* Stamp column 'col' of the block holding 'row' as written at 'tick'. */
+void archetype_stamp_write(archetype *a, int64_t col, int64_t row,
+                           int64_t tick);
+
+/* Check if block 'block' of 'a' passes the CHANGED and ADDED terms of
+   'sys'. */
+bool archetype_block_passes(archetype *a, int64_t block, system_data *sys);
+
 /* Given a string of types "ComponentA,ComponentB,ComponentC", hash each item
    delimited by ',' and sort the vector so that it is ordered. */
 void archetype_key(char *types, hash_vec *key);
 
+/* The cached transition from 'from' to 'to', building its copy plan the
+   first time. Not thread safe, once built the edge is only read. */
+archetype_edge *archetype_find_edge(g_core *w, archetype *from,
+                                    archetype *to);
+
+/* Copy the components 'from' shares with the destination of 'e' out of the
+   ascending 'rows' into the 'n' rows starting at 'dst'. Neither archetype is
+   resized so distinct row ranges may be copied concurrently. */
+void archetype_copy_rows(archetype_edge *e, archetype *from, int64_t *rows,
+                         int64_t dst, int64_t n);
+
+/* Remove the ascending 'rows' of 'a'. The entities moved into the holes have
+   their position updated. */
+void archetype_remove_rows(archetype *a, int64_t *rows, int64_t n);
+
+/* Move the 'n' entities 'entts' stored at the ascending 'rows' of 'from' to
+   'to' in one go. Rows are ignored when 'from' is the empty archetype. */
+void archetype_move_rows(g_core *w, archetype *from, archetype *to,
+                         gid *entts, int64_t *rows, int64_t n);
+
+/* Find the archetype of 'w' with the sorted types 'key', creating it if it
+   does not exist yet. */
+archetype *archetype_resolve(g_core *w, hash_vec *key);
+
 /* Transition an entity from its current position to a new archetype with
    'types' */
 void delta_transition(g_core *w, gid entt, hash_vec *to_key);
 
-/* Creates a new thread and spins up this archetype. Use only once */
-void subthread_archetype(archetype *a);
+/* Delta keys identify adding or removing the sorted types 'key' from any
+   archetype. */
+#define EDGE_ADD_KEY(key) (hash_vector(key))
+#define EDGE_REM_KEY(key) (~hash_vector(key))
+
+/* Archetypes whose keys hash alike take the ids this far apart. */
+#define REGISTRY_PROBE_STEP 0x9e3779b97f4a7c15ull
+
+/* The archetype 'from' remembered reaching by adding ('add') or removing the
+   sorted types 'delta'. Returns NULL if no such edge was remembered yet. */
+archetype *edge_follow(g_core *w, archetype *from, hash_vec *delta,
+                       bool add);
+
+/* Transition 'entt' over the edge its archetype cached for adding ('add') or
+   removing 'delta'. Returns false, doing nothing, if there is none. */
+bool edge_transition(g_core *w, gid entt, hash_vec *delta, bool add);
+
+/* Remember that applying 'delta_key' to 'from' leads to 'to'. */
+void edge_remember(archetype *from, uint64_t delta_key, archetype *to);
+
+/* Runs the systems of 'process_arch' stage by stage. All but one system of a
+   stage are submitted to the worker pool, the last stage under 'tick_group'.
+   When 'tick_group' is NULL everything runs on the current thread. */
+void archetype_perform_process(g_core *w, archetype *process_arch,
+                               task_group *tick_group);
 
-/* Performs the thread process on the current thread instead of being managed
-   on a different one */
-void archetype_perform_process(g_core *w, archetype *process_arch);
+/* Order the contenders of 'a' into stages following the read and write sets
+   of each system. Called whenever the contenders change. */
+void archetype_schedule(archetype *a);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,46 @@
+#include "chunk.h"
+#include "logger.h"
+
+/*-------------------------------------------------------
+ * Container Operations
+ *-------------------------------------------------------*/
+void chunk_pool_init(chunk_pool *p, stalloc *alloc) {
+  pthread_mutex_init(&p->lock, NULL);
+  chunk_vec_inita(&p->free_chunks, alloc, TO_HEAP, 16);
+}
+
+void chunk_pool_free(chunk_pool *p) {
+  for (int64_t i = 0; i < p->free_chunks.length; i++)
+    free(*chunk_vec_at(&p->free_chunks, i));
+  chunk_vec_free(&p->free_chunks);
+  pthread_mutex_destroy(&p->lock);
+}
+
+/*-------------------------------------------------------
+ * Chunk Operations
+ *-------------------------------------------------------*/
+void *chunk_acquire(chunk_pool *p) {
+  void *chunk = NULL;
+
+  pthread_mutex_lock(&p->lock);
+  if (p->free_chunks.length) {
+    chunk = *chunk_vec_top(&p->free_chunks);
+    chunk_vec_pop(&p->free_chunks);
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  if (chunk) return chunk;
+
+  chunk = aligned_alloc(COLUMN_ALIGNMENT, G_CHUNK_SIZE);
+  if (!chunk) {
+    log_error("Unable to allocate chunk");
+    exit(EXIT_FAILURE);
+  }
+  return chunk;
+}
+
+void chunk_release(chunk_pool *p, void *chunk) {
+  pthread_mutex_lock(&p->lock);
+  chunk_vec_push(&p->free_chunks, &chunk);
+  pthread_mutex_unlock(&p->lock);
+}
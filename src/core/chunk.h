@@ -0,0 +1,31 @@
+/* =========================================================================
+    Author: E.D Choparinov, Amsterdam
+    Related Files: chunk.h chunk.c
+    Purpose:
+        The purpose of this file is to house the pool of fixed size chunks
+        used by archetypes stored with G_LAYOUT_CHUNKED. Every chunk of a
+        world has the same size so a chunk released by one archetype can be
+        reused by any other archetype of the same world without touching
+        the system allocator.
+========================================================================= */
+#ifndef __HEADER_CHUNK_H__
+#define __HEADER_CHUNK_H__
+
+#include "gecs.h"
+
+/* Initialize an empty chunk pool 'p'. The pools bookkeeping is allocated
+   on 'alloc'. */
+void chunk_pool_init(chunk_pool *p, stalloc *alloc);
+
+/* Free every chunk held by the pool 'p'. Chunks still owned by archetypes
+   must be released before. */
+void chunk_pool_free(chunk_pool *p);
+
+/* Take a chunk of G_CHUNK_SIZE bytes aligned to COLUMN_ALIGNMENT from the
+   pool 'p'. A new chunk is allocated if the pool is empty. Thread safe. */
+void *chunk_acquire(chunk_pool *p);
+
+/* Hand 'chunk' back to the pool 'p' for reuse. Thread safe. */
+void chunk_release(chunk_pool *p, void *chunk);
+
+#endif
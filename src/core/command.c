@@ -0,0 +1,662 @@
+#include "command.h"
+#include "archetype.h"
+#include "entity.h"
+#include "scheduler.h"
+
+/* Commands are sorted by entity. Between the commands of one entity,
+   `epoch` orders those recorded on different threads and `order`, the
+   position they were gathered at, those of the same buffer. */
+typedef struct command_ref {
+  gid      entt;
+  int64_t  epoch;
+  int64_t  order;
+  command *cmd;
+} command_ref;
+
+/* Where the commands of one entity take it. */
+typedef struct migration {
+  archetype      *from, *to; /* `to` is NULL when the entity is destroyed. */
+  archetype_edge *edge;      /* The transition taken, NULL if there is none. */
+  gid             entt;
+  int64_t         row;       /* The row inside `from` before applying. */
+  int64_t         dst;       /* The row inside `to` after applying. */
+  command_ref    *refs;      /* The commands of the entity, in order. */
+  int64_t         n;
+  bool            created;
+} migration;
+
+/* Destinations resolved while applying, keyed by a hash of the source
+   archetype and structural commands. The migration that resolved a route is
+   kept so a hit can be checked against it. The last one is kept aside since
+   entities recorded one after the other mostly take the same route. */
+typedef struct route_cache {
+  cache_map  known; /* Map : route -> migration */
+  uint64_t   last;
+  migration *last_m;
+} route_cache;
+
+/* Open addressing table from entity to its newest command in one buffer.
+   Only the owner of the buffer inserts, other threads may probe at the same
+   time. A slot is taken once `last` is published, `entt` is written before
+   it. Outgrown tables stay alive until the buffer is cleared since readers
+   may still hold them. */
+#define COMMAND_TABLE_START 64
+typedef struct command_slot {
+  gid      entt;
+  command *last;
+} command_slot;
+
+struct command_table {
+  int64_t      capacity; /* A power of two, at most half of it is in use. */
+  command_slot slots[];
+};
+
+/* The columns of one archetype looked up last. Entities moving together
+   mostly write the same few components. */
+#define COLUMN_CACHE_SIZE 8
+typedef struct column_cache {
+  int64_t  length;
+  uint64_t types[COLUMN_CACHE_SIZE];
+  int64_t  columns[COLUMN_CACHE_SIZE];
+} column_cache;
+
+/*-------------------------------------------------------
+ * Static Command Functions
+ *-------------------------------------------------------*/
+static command_buffer *local_buffer(g_core *w) {
+  int64_t idx = w->workers ? scheduler_thread_index(w->workers) : 0;
+  assert(idx < w->command_count && "No command buffer for this thread!");
+  return &w->commands[idx];
+}
+
+/* Carve 'size' bytes out of the blocks of 'b'. The alignment is the largest
+   power of two dividing 'size', which is at least the alignment of any type
+   of that size. */
+static void *payload_alloc(command_buffer *b, gsize size) {
+  gsize align = size & -size;
+  if (align > COLUMN_ALIGNMENT || align == 0) align = COLUMN_ALIGNMENT;
+
+  if (size > COMMAND_BLOCK_SIZE) {
+    gsize bytes = (size + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT;
+    void *large = aligned_alloc(COLUMN_ALIGNMENT, bytes * COLUMN_ALIGNMENT);
+    chunk_vec_push(&b->large, &large);
+    return large;
+  }
+
+  gsize at = (b->used + align - 1) & ~(align - 1);
+  if (b->blocks.length == 0 || at + size > COMMAND_BLOCK_SIZE) {
+    if (b->blocks.length) b->block++;
+    if (b->block == b->blocks.length) {
+      void *block = aligned_alloc(COLUMN_ALIGNMENT, COMMAND_BLOCK_SIZE);
+      chunk_vec_push(&b->blocks, &block);
+    }
+    at = 0;
+  }
+
+  b->used = at + size;
+  return (char *)*chunk_vec_at(&b->blocks, b->block) + at;
+}
+
+static command_table *table_create(int64_t capacity) {
+  command_table *t =
+      calloc(1, sizeof(command_table) + capacity * sizeof(command_slot));
+  t->capacity = capacity;
+  return t;
+}
+
+/* The slot of 'entt' in 't', or the empty slot it would take. */
+static command_slot *table_probe(command_table *t, gid entt) {
+  uint64_t at = (entt * 0x9E3779B97F4A7C15ull) >> 32;
+  for (;; at++) {
+    command_slot *slot = &t->slots[at & (t->capacity - 1)];
+    if (!__atomic_load_n(&slot->last, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&slot->entt, __ATOMIC_RELAXED) == entt)
+      return slot;
+  }
+}
+
+/* Replace the table of 'b' with one twice its size. */
+static void table_grow(command_buffer *b) {
+  command_table *old = b->latest;
+  command_table *t = table_create(old->capacity * 2);
+  for (int64_t i = 0; i < old->capacity; i++) {
+    if (!old->slots[i].last) continue;
+    *table_probe(t, old->slots[i].entt) = old->slots[i];
+  }
+  chunk_vec_push(&b->outgrown, (void **)&old);
+  __atomic_store_n(&b->latest, t, __ATOMIC_RELEASE);
+}
+
+/* Make 'cmd' the newest command of its entity in 'b'. */
+static void table_insert(command_buffer *b, command *cmd) {
+  if ((b->entities + 1) * 2 > b->latest->capacity) table_grow(b);
+  command_slot *slot = table_probe(b->latest, cmd->entt);
+  cmd->prev = slot->last;
+  if (!cmd->prev) {
+    __atomic_store_n(&slot->entt, cmd->entt, __ATOMIC_RELAXED);
+    b->entities++;
+  }
+  __atomic_store_n(&slot->last, cmd, __ATOMIC_RELEASE);
+}
+
+static void buffer_clear(command_buffer *b) {
+  for (int64_t i = 0; i < b->outgrown.length; i++)
+    free(*chunk_vec_at(&b->outgrown, i));
+  chunk_vec_clear(&b->outgrown);
+  if (b->entities)
+    memset(b->latest->slots, 0, b->latest->capacity * sizeof(command_slot));
+  b->entities = 0;
+
+  command_vec_clear(&b->commands);
+  for (int64_t i = 0; i < b->large.length; i++)
+    free(*chunk_vec_at(&b->large, i));
+  chunk_vec_clear(&b->large);
+  b->block = 0;
+  b->used = 0;
+}
+
+/* The newest command of 'entt' in 'b' that 'wanted' accepts, NULL if none.
+   Safe while the owner of 'b' appends. */
+static command *buffer_find(command_buffer *b, gid entt,
+                            bool (*wanted)(command *, uint64_t),
+                            uint64_t type) {
+  command_table *t = __atomic_load_n(&b->latest, __ATOMIC_ACQUIRE);
+  command_slot  *slot = table_probe(t, entt);
+  for (command *cmd = __atomic_load_n(&slot->last, __ATOMIC_ACQUIRE); cmd;
+       cmd = cmd->prev)
+    if (wanted(cmd, type)) return cmd;
+  return NULL;
+}
+
+/* Search every buffer for the newest command of 'entt' that 'wanted'
+   accepts. Commands of the same epoch were recorded concurrently, the one
+   of the later buffer is taken like `command_apply` does. */
+static command *find_latest(g_core *w, gid entt,
+                            bool (*wanted)(command *, uint64_t),
+                            uint64_t type) {
+  command *latest = NULL;
+  for (int64_t i = 0; i < w->command_count; i++) {
+    command *cmd = buffer_find(&w->commands[i], entt, wanted, type);
+    if (cmd && (!latest || cmd->epoch >= latest->epoch)) latest = cmd;
+  }
+  return latest;
+}
+
+static bool decides_type(command *cmd, uint64_t type) {
+  return cmd->op == CMD_DESTROY || (cmd->op >= CMD_ADD && cmd->type == type);
+}
+
+static bool creates(command *cmd, uint64_t type) {
+  return cmd->op == CMD_CREATE;
+}
+
+static int compare_refs(const void *a, const void *b) {
+  const command_ref *x = a;
+  const command_ref *y = b;
+  if (x->entt != y->entt) return x->entt < y->entt ? -1 : 1;
+  if (x->epoch != y->epoch) return x->epoch < y->epoch ? -1 : 1;
+  return (x->order > y->order) - (x->order < y->order);
+}
+
+static int compare_routes(const void *a, const void *b) {
+  const migration *x = a;
+  const migration *y = b;
+  if (x->from != y->from) return x->from < y->from ? -1 : 1;
+  if (x->to != y->to) return x->to < y->to ? -1 : 1;
+  return (x->row > y->row) - (x->row < y->row);
+}
+
+static int compare_rows(const void *a, const void *b) {
+  const int64_t *x = a;
+  const int64_t *y = b;
+  return (*x > *y) - (*x < *y);
+}
+
+/* Fold 'value' into the route hash 'h'. */
+static uint64_t route_step(uint64_t h, uint64_t value) {
+  return h ^ (value + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2));
+}
+
+static bool is_structural(command *cmd) {
+  return cmd->op == CMD_ADD || cmd->op == CMD_REMOVE;
+}
+
+/* Check if 'a' and 'b' leave the same archetype through the same structural
+   commands, which takes them to the same place. */
+static bool same_route(migration *a, migration *b) {
+  if (a->from != b->from || a->created != b->created) return false;
+  int64_t i = 0, j = 0;
+  for (;;) {
+    while (i < a->n && !is_structural(a->refs[i].cmd)) i++;
+    while (j < b->n && !is_structural(b->refs[j].cmd)) j++;
+    if (i == a->n || j == b->n) return i == a->n && j == b->n;
+
+    command *x = a->refs[i++].cmd;
+    command *y = b->refs[j++].cmd;
+    if (x->op != y->op || x->type != y->type) return false;
+  }
+}
+
+/* Check if the entity of 'm' holds the component of command 'i' right before
+   that command runs. */
+static bool was_live(migration *m, int64_t i) {
+  uint64_t type = m->refs[i].cmd->type;
+  for (int64_t j = i - 1; j >= 0; j--) {
+    command *cmd = m->refs[j].cmd;
+    if (cmd->type != type) continue;
+    if (cmd->op == CMD_ADD) return true;
+    if (cmd->op == CMD_REMOVE) return false;
+  }
+  return m->from != &empty_archetype && type_set_has(&m->from->types, &type);
+}
+
+static int64_t cached_column(column_cache *c, archetype *a, uint64_t type) {
+  for (int64_t i = 0; i < c->length; i++)
+    if (c->types[i] == type) return c->columns[i];
+
+  int64_t col = archetype_column(a, type);
+  if (c->length < COLUMN_CACHE_SIZE) {
+    c->types[c->length] = type;
+    c->columns[c->length++] = col;
+  }
+  return col;
+}
+
+static int64_t find_type(hash_vec *types, uint64_t type) {
+  for (int64_t i = 0; i < types->length; i++)
+    if (*hash_vec_at(types, i) == type) return i;
+  return -1;
+}
+
+static void remove_type(hash_vec *types, int64_t at) {
+  *hash_vec_at(types, at) = *hash_vec_top(types);
+  hash_vec_pop(types);
+}
+
+feach(collect_types, kvpair, item, {
+  hash_vec *types = args;
+  hash_vec_push(types, item.key);
+});
+static compare(sort_hashes, gid, a, b, { return a < b; });
+
+/* Work out where the entity of the 'n' commands at 'refs' ends up. Returns
+   false if there is nothing left to move, entities that never had a row are
+   released right away. */
+static bool plan_entity(g_core *w, route_cache *routes, command_ref *refs,
+                        int64_t n, migration *m) {
+  gid  entt = refs[0].cmd->entt;
+  bool created = false;
+  for (int64_t i = 0; i < n; i++) {
+    if (refs[i].cmd->op == CMD_CREATE) created = true;
+
+    /* Destroying wins over everything else recorded this tick */
+    if (refs[i].cmd->op == CMD_DESTROY) {
+      entity_record *rec = entity_lookup(&w->entity_registry, entt);
+      if (!rec || rec->arch == &empty_archetype) {
+        entity_release(w, entt);
+        return false;
+      }
+      *m = (migration){.from = rec->arch, .entt = entt, .row = rec->row};
+      return true;
+    }
+  }
+
+  entity_record *rec = entity_lookup(&w->entity_registry, entt);
+  if (created) rec = entity_insert(&w->entity_registry, entt);
+  if (!rec) return false; /* The handle went stale before the tick ended */
+
+  *m = (migration){.from = rec->arch, .to = rec->arch, .entt = entt,
+                   .row = rec->row, .refs = refs, .n = n, .created = created};
+
+  /* Entities leaving the same archetype through the same structural
+     commands end up in the same place, only the first one resolves it. */
+  uint64_t route = route_step(m->from->hash_name, created);
+  bool     moved = created;
+  for (int64_t i = 0; i < n; i++) {
+    command *cmd = refs[i].cmd;
+    if (!is_structural(cmd)) continue;
+    route = route_step(route_step(route, cmd->op), cmd->type);
+    moved = true;
+  }
+  if (!moved) return true;
+
+  /* Routes sharing a hash are told apart by their commands */
+  if (routes->last_m && routes->last == route &&
+      same_route(routes->last_m, m)) {
+    m->to = routes->last_m->to;
+    return true;
+  }
+  migration **known =
+      (migration **)cache_map_get(&routes->known, &route).value;
+  if (known && same_route(*known, m)) {
+    m->to = (*known)->to;
+    routes->last = route;
+    routes->last_m = *known;
+    return true;
+  }
+
+  /* Replay the structural commands on the type list of the entity */
+  start_frame(w->allocator);
+  hash_vec types;
+  hash_vec_sinit(&types, n + 1 + m->from->columns.length);
+  if (m->from != &empty_archetype)
+    map_foreach(&m->from->types.internals, collect_types, &types);
+
+  uint64_t id_type = hash_mem("GecID", 5);
+  if (created) hash_vec_push(&types, &id_type);
+
+  for (int64_t i = 0; i < n; i++) {
+    command *cmd = refs[i].cmd;
+    int64_t  at = find_type(&types, cmd->type);
+    if (cmd->op == CMD_ADD && at == -1) hash_vec_push(&types, &cmd->type);
+    if (cmd->op == CMD_REMOVE && at != -1) remove_type(&types, at);
+  }
+
+  hash_vec_sort(&types, sort_hashes, NULL);
+  m->to = archetype_resolve(w, &types);
+  cache_map_put(&routes->known, &route, &m);
+  routes->last = route;
+  routes->last_m = m;
+  end_frame(w->allocator);
+  return true;
+}
+
+/* Write the values recorded for the entity of 'm' into its final row. A
+   component added after being removed starts over from the value of the
+   ADD, values of removed components are skipped because their column is
+   gone. */
+static void write_values(migration *m, uint64_t id_type, column_cache *c) {
+  archetype *to = m->to;
+  if (m->created) {
+    int64_t id_col = cached_column(c, to, id_type);
+    ((GecID *)archetype_field(to, m->dst, id_col))->id = m->entt;
+  }
+
+  for (int64_t i = 0; i < m->n; i++) {
+    command *cmd = m->refs[i].cmd;
+    if (cmd->op != CMD_ADD && cmd->op != CMD_SET) continue;
+
+    /* Adding a component the entity already has keeps its value */
+    bool live = was_live(m, i);
+    if (cmd->op == CMD_ADD ? live : !live) continue;
+
+    int64_t col = cached_column(c, to, cmd->type);
+    if (col != -1)
+      memcpy(archetype_field(to, m->dst, col), cmd->payload, cmd->size);
+  }
+}
+
+/* Index one past the last migration sharing the source of 'm[start]', and
+   also its destination when 'by_route' is set. */
+static int64_t group_end(migration *m, int64_t start, int64_t n,
+                         bool by_route) {
+  int64_t end = start;
+  while (end < n && m[end].from == m[start].from &&
+         (!by_route || m[end].to == m[start].to))
+    end++;
+  return end;
+}
+
+/* Stamp the components the commands of 'm' write as changed at 'tick'. */
+static void stamp_values(migration *m, column_cache *c, int64_t tick) {
+  for (int64_t i = 0; i < m->n; i++) {
+    command *cmd = m->refs[i].cmd;
+    if (cmd->op != CMD_ADD && cmd->op != CMD_SET) continue;
+    int64_t col = cached_column(c, m->to, cmd->type);
+    if (col != -1) archetype_stamp_write(m->to, col, m->dst, tick);
+  }
+}
+
+/* Hand out the rows every moving entity ends up in, point its record there
+   and stamp the change ticks of the rows. This is the only part touching the
+   entity index, the size of archetypes and their ticks, it runs on the
+   calling thread. */
+static void place_entities(g_core *w, migration *m, int64_t n, int64_t tick) {
+  gid     *entts = malloc(sizeof(gid) * n);
+  int64_t *rows = malloc(sizeof(int64_t) * n);
+  for (int64_t start = 0, end = 0; start < n; start = end) {
+    end = group_end(m, start, n, true);
+    archetype   *from = m[start].from;
+    archetype   *to = m[start].to;
+    column_cache cache = {0};
+    if (!to) continue;
+
+    if (from == to) {
+      for (int64_t i = start; i < end; i++) {
+        m[i].dst = m[i].row;
+        stamp_values(&m[i], &cache, tick);
+      }
+      continue;
+    }
+
+    for (int64_t i = start; i < end; i++) {
+      entts[i - start] = m[i].entt;
+      rows[i - start] = m[i].row;
+    }
+    int64_t dst = archetype_push_rows(to, entts, end - start);
+    archetype_stamp_rows(from, rows, to, dst, end - start, tick);
+    archetype_edge *edge =
+        from != &empty_archetype ? archetype_find_edge(w, from, to) : NULL;
+
+    for (int64_t i = start; i < end; i++) {
+      entity_record *rec = entity_lookup(&w->entity_registry, m[i].entt);
+      m[i].dst = dst + i - start;
+      m[i].edge = edge;
+      rec->arch = to;
+      rec->row = m[i].dst;
+      stamp_values(&m[i], &cache, tick);
+    }
+  }
+  free(rows);
+  free(entts);
+}
+
+/* Copy the rows of one (source, destination) pair and write their values.
+   Pairs write disjoint rows and only read rows of their source that are not
+   removed yet. */
+static void copy_job(task *t) {
+  migration *m = (migration *)t->ctx[1] + t->start_at;
+  uint64_t   id_type = *(uint64_t *)t->ctx[2];
+  int64_t    n = t->stop_at - t->start_at;
+  if (!m[0].to) return;
+
+  if (m[0].edge) {
+    int64_t *rows = malloc(sizeof(int64_t) * n);
+    for (int64_t i = 0; i < n; i++)
+      rows[i] = m[i].row;
+    archetype_copy_rows(m[0].edge, m[0].from, rows, m[0].dst, n);
+    free(rows);
+  }
+
+  column_cache cache = {0};
+  for (int64_t i = 0; i < n; i++)
+    write_values(&m[i], id_type, &cache);
+}
+
+/* Remove every row that left one source archetype, then release the
+   entities destroyed there. Only the source and the records of its own
+   entities are touched, the free list is lock free. */
+static void remove_job(task *t) {
+  g_core    *w = t->ctx[0];
+  migration *m = (migration *)t->ctx[1] + t->start_at;
+  int64_t    n = t->stop_at - t->start_at;
+  archetype *from = m[0].from;
+  if (from == &empty_archetype) return;
+
+  int64_t *rows = malloc(sizeof(int64_t) * n);
+  int64_t  count = 0;
+  for (int64_t i = 0; i < n; i++)
+    if (m[i].to != from) rows[count++] = m[i].row;
+  qsort(rows, count, sizeof(int64_t), compare_rows);
+  archetype_remove_rows(from, rows, count);
+  free(rows);
+
+  for (int64_t i = 0; i < n && !m[i].to; i++)
+    entity_release(w, m[i].entt);
+}
+
+/* Run 'job' over every group of the 'n' sorted migrations, on the worker
+   pool when there is enough work to make it worth it. */
+static void run_groups(g_core *w, migration *m, int64_t n, bool by_route,
+                       task_fn job, void *arg) {
+  scheduler *workers = w->workers;
+  bool concurrent = w->disable_concurrency == 0 && workers &&
+                    workers->thread_count > 1 &&
+                    n >= w->each_serial_threshold;
+
+  task_group group;
+  task_group_init(&group);
+  for (int64_t start = 0, end = 0; start < n; start = end) {
+    end = group_end(m, start, n, by_route);
+    task t = {.run = job, .group = &group, .ctx = {w, m, arg},
+              .start_at = start, .stop_at = end};
+    if (concurrent) scheduler_submit(workers, &t);
+    else job(&t);
+  }
+  if (concurrent) scheduler_wait(workers, &group);
+}
+
+/*-------------------------------------------------------
+ * Command Operations
+ *-------------------------------------------------------*/
+void command_buffers_reserve(g_core *w, int64_t count) {
+  if (count <= w->command_count) return;
+
+  w->commands = realloc(w->commands, sizeof(command_buffer) * count);
+  for (int64_t i = w->command_count; i < count; i++) {
+    command_buffer *b = &w->commands[i];
+    command_vec_inita(&b->commands, w->allocator, TO_HEAP, 64);
+    b->latest = table_create(COMMAND_TABLE_START);
+    b->entities = 0;
+    chunk_vec_inita(&b->outgrown, w->allocator, TO_HEAP, 4);
+    chunk_vec_inita(&b->blocks, w->allocator, TO_HEAP, 4);
+    chunk_vec_inita(&b->large, w->allocator, TO_HEAP, 4);
+    b->block = 0;
+    b->used = 0;
+  }
+  w->command_count = count;
+}
+
+void command_buffers_free(g_core *w) {
+  for (int64_t i = 0; i < w->command_count; i++) {
+    command_buffer *b = &w->commands[i];
+    buffer_clear(b);
+    for (int64_t j = 0; j < b->blocks.length; j++)
+      free(*chunk_vec_at(&b->blocks, j));
+    command_vec_free(&b->commands);
+    free(b->latest);
+    chunk_vec_free(&b->outgrown);
+    chunk_vec_free(&b->blocks);
+    chunk_vec_free(&b->large);
+  }
+  free(w->commands);
+  w->commands = NULL;
+  w->command_count = 0;
+}
+
+void *command_push(g_core *w, int8_t op, gid entt, uint64_t type,
+                   void *data) {
+  command_buffer *b = local_buffer(w);
+  command        *cmd = payload_alloc(b, sizeof(command));
+  *cmd = (command){.op = op, .entt = entt, .type = type};
+  cmd->epoch = atomic_load_explicit(&w->command_epoch, memory_order_relaxed);
+
+  if (op == CMD_ADD || op == CMD_SET) {
+    gsize *size = hash_to_size_get(&w->component_registry, &type).value;
+    assert(size && "Component is not registered!");
+    cmd->size = *size;
+    cmd->payload = payload_alloc(b, cmd->size);
+    if (data) memcpy(cmd->payload, data, cmd->size);
+    else memset(cmd->payload, 0, cmd->size);
+  }
+
+  command_vec_push(&b->commands, &cmd);
+  table_insert(b, cmd);
+
+  /* Entities created this tick have no record, they are always searched */
+  entity_record *rec = entity_lookup(&w->entity_registry, entt);
+  if (rec) __atomic_store_n(&rec->pending, w->command_round, __ATOMIC_RELAXED);
+  return cmd->payload;
+}
+
+bool command_pending(g_core *w, gid entt) {
+  entity_record *rec = entity_lookup(&w->entity_registry, entt);
+  return !rec ||
+         __atomic_load_n(&rec->pending, __ATOMIC_RELAXED) == w->command_round;
+}
+
+command *command_last(g_core *w, gid entt, uint64_t type) {
+  return find_latest(w, entt, decides_type, type);
+}
+
+bool command_created(g_core *w, gid entt) {
+  return find_latest(w, entt, creates, 0) != NULL;
+}
+
+void command_fence(g_core *w) {
+  atomic_fetch_add_explicit(&w->command_epoch, 1, memory_order_relaxed);
+}
+
+void command_apply(g_core *w) {
+  log_enter;
+
+  int64_t total = 0;
+  for (int64_t i = 0; i < w->command_count; i++)
+    total += w->commands[i].commands.length;
+
+  if (total) {
+    /* Gather every buffer and group by entity. The commands of one entity
+       keep the order they were recorded in, whichever thread did. */
+    command_ref *refs = malloc(sizeof(command_ref) * total);
+    int64_t      at = 0;
+    bool         sorted = true;
+    for (int64_t i = 0; i < w->command_count; i++) {
+      command_vec *cmds = &w->commands[i].commands;
+      for (int64_t j = 0; j < cmds->length; j++, at++) {
+        command *cmd = *command_vec_at(cmds, j);
+        refs[at] = (command_ref){cmd->entt, cmd->epoch, at, cmd};
+        if (at && compare_refs(&refs[at - 1], &refs[at]) > 0) sorted = false;
+      }
+    }
+
+    /* Entities are mostly recorded one after the other already */
+    if (!sorted) qsort(refs, total, sizeof(command_ref), compare_refs);
+
+    /* Plan every entity first so each pair of archetypes moves together */
+    migration      *plan = malloc(sizeof(migration) * total);
+    int64_t         planned = 0;
+    route_cache     routes = {0};
+    cache_map_inita(&routes.known, w->allocator, TO_HEAP, 16);
+    for (int64_t start = 0, end = 0; start < total; start = end) {
+      for (end = start; end < total; end++)
+        if (refs[end].entt != refs[start].entt) break;
+      if (plan_entity(w, &routes, refs + start, end - start, &plan[planned]))
+        planned++;
+    }
+
+    /* Rows are handed out first so copying into them and removing the
+       rows left behind can both run per archetype. Destroyed entities
+       sort first inside their source. */
+    for (int64_t i = 1; i < planned; i++) {
+      if (compare_routes(&plan[i - 1], &plan[i]) <= 0) continue;
+      qsort(plan, planned, sizeof(migration), compare_routes);
+      break;
+    }
+    place_entities(w, plan, planned, archetype_next_tick(w));
+
+    uint64_t id_type = hash_mem("GecID", 5);
+    run_groups(w, plan, planned, true, copy_job, &id_type);
+    run_groups(w, plan, planned, false, remove_job, NULL);
+
+    cache_map_free(&routes.known);
+    free(plan);
+    free(refs);
+  }
+
+  /* Marks the records carry from this round are stale from here on */
+  for (int64_t i = 0; i < w->command_count; i++)
+    buffer_clear(&w->commands[i]);
+  w->command_round++;
+
+  log_leave;
+}
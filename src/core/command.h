@@ -0,0 +1,56 @@
+/* =========================================================================
+    Author: E.D Choparinov, Amsterdam
+    Related Files: command.h command.c
+    Purpose:
+        The purpose of this file is to record the structural changes
+        systems make while a tick is running. Each scheduler thread appends
+        to its own command buffer so recording never locks. At the end of
+        the tick every buffer is sorted by entity and applied to the world
+        in a single pass, each entity moving at most once.
+========================================================================= */
+#ifndef __HEADER_COMMAND_H__
+#define __HEADER_COMMAND_H__
+
+#include "gecs.h"
+
+#define CMD_CREATE  0
+#define CMD_DESTROY 1
+#define CMD_ADD     2
+#define CMD_REMOVE  3
+#define CMD_SET     4
+
+/* Make sure 'w' has at least 'count' command buffers. Not thread safe. */
+void command_buffers_reserve(g_core *w, int64_t count);
+
+/* Free every command buffer of 'w'. */
+void command_buffers_free(g_core *w);
+
+/* Record 'op' on 'entt' for component 'type' into the buffer of the calling
+   thread. ADD and SET copy the component from 'data', ADD zeroes it when
+   'data' is NULL. Returns the payload of ADD and SET, NULL otherwise. The
+   payload stays valid until the end of the tick. */
+void *command_push(g_core *w, int8_t op, gid entt, uint64_t type, void *data);
+
+/* Check if commands for 'entt' may be waiting. Entities without a record,
+   like those created this tick, always may. Lookups of entities without
+   commands are answered here without searching the buffers. */
+bool command_pending(g_core *w, gid entt);
+
+/* The last command recorded this tick, by any thread, which decides whether
+   'entt' has 'type'. That is an ADD, SET or REMOVE of 'type' or a DESTROY of
+   'entt'. Returns NULL if there is none. Commands other threads record
+   meanwhile may be missed, those joined before are not. */
+command *command_last(g_core *w, gid entt, uint64_t type);
+
+/* Check if any thread recorded the creation of 'entt' this tick. */
+bool command_created(g_core *w, gid entt);
+
+/* Order the commands recorded before this call ahead of those other threads
+   record after it. Called where work is handed to or joined from the
+   worker pool. */
+void command_fence(g_core *w);
+
+/* Apply and clear the commands of every buffer of 'w'. Not thread safe. */
+void command_apply(g_core *w);
+
+#endif
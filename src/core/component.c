@@ -1,45 +1,229 @@
 #include "component.h"
 #include "archetype.h"
+#include "command.h"
 #include "entity.h"
 #include "gecs.h"
+#include "signature.h"
+
+/* Component ids are handed out process wide so all worlds agree on them. */
+static pthread_mutex_t cid_lock = PTHREAD_MUTEX_INITIALIZER;
+static stalloc        *cid_allocator = NULL;
+static hash_to_size    cid_registry; /* Map : hash(comp name) -> g_cid */
+static size_vec        cid_alignment; /* Vec : g_cid -> alignment */
+static size_vec        cid_size;      /* Vec : g_cid -> declared size or 0 */
 
 /*-------------------------------------------------------
  * Static Component Functions
  *-------------------------------------------------------*/
-static g_core *select_component_location_ctx(g_query *q, gid entt, gid type) {
-  /* Check if this archetype from the real context contains this component and
-     return. If not, fall back to the simulation context and try there. */
-  g_core *ctx = q->world_ctx;
-
-  if (!type_set_has(&q->archetype_ctx->types, &type)) {
-    /* Component must exist in the simulation context */
-    ctx = q->archetype_ctx->simulation;
-    archetype *sim_arch = load_entity_archetype(ctx, entt);
-    assert(type_set_has(&sim_arch->types, &type) &&
-           "Component does not exist on this entity!");
+/* Returns true if 'arch' has every type in 'types'. */
+static bool has_all_types(archetype *arch, hash_vec *types) {
+  for (int64_t i = 0; i < types->length; i++)
+    if (!type_set_has(&arch->types, hash_vec_at(types, i))) return false;
+  return true;
+}
+
+static compare(sort_hashes, gid, a, b, { return a < b; });
+feach(push_to_types, kvpair, item, {
+  hash_vec *type_list = args;
+  gid      *id = item.key;
+  hash_vec_push(type_list, id);
+});
+
+/* Return the archetype reached by adding ('add') or removing the sorted
+   'types' from 'from', remembering it as an edge of 'from'. */
+static archetype *transition_target(g_core *w, archetype *from,
+                                    hash_vec *types, bool add) {
+  uint64_t   delta_key = add ? EDGE_ADD_KEY(types) : EDGE_REM_KEY(types);
+  archetype *known = edge_follow(w, from, types, add);
+  if (known) return known;
+
+  hash_vec key;
+  hash_vec_sinit(&key, types->length + 1);
+  if (add) {
+    for (int64_t i = 0; i < types->length; i++) {
+      gid *component_id = hash_vec_at(types, i);
+      assert((from == &empty_archetype ||
+              !type_set_has(&from->types, component_id)) &&
+             "Adding a component that already is on this entity!");
+      hash_vec_push(&key, component_id);
+    }
+    if (from != &empty_archetype)
+      map_foreach(&from->types.internals, push_to_types, &key);
+  } else {
+    assert(from != &empty_archetype && has_all_types(from, types) &&
+           "Remove contains component already not on entity!");
+    type_set retained;
+    type_set_copy(&retained, &from->types);
+    for (int64_t i = 0; i < types->length; i++)
+      type_set_del(&retained, hash_vec_at(types, i));
+    set_to_vec((set *)&retained, (vec *)&key);
   }
+  hash_vec_sort(&key, sort_hashes, NULL);
+
+  archetype *to = archetype_resolve(w, &key);
+  edge_remember(from, delta_key, to);
+  return to;
+}
+
+typedef struct batch_item {
+  archetype *arch;
+  int64_t    row;
+  gid        entt;
+} batch_item;
+
+static int compare_batch_items(const void *a, const void *b) {
+  const batch_item *x = a;
+  const batch_item *y = b;
+  if (x->arch != y->arch) return x->arch < y->arch ? -1 : 1;
+  if (x->row != y->row) return x->row < y->row ? -1 : 1;
+  return (x->entt > y->entt) - (x->entt < y->entt);
+}
+
+/* Move the 'entts' grouped by their archetype, each group only resolves its
+   destination once and moves all of its rows together. */
+static void component_batch(g_core *w, gid *entts, int64_t n, char *types,
+                            bool add) {
+  if (n == 0) return;
+  start_frame(w->allocator);
+  hash_vec delta;
+  archetype_key(types, &delta);
+
+  batch_item *items = malloc(sizeof(batch_item) * n);
+  for (int64_t i = 0; i < n; i++) {
+    entity_record *rec = entity_lookup(&w->entity_registry, entts[i]);
+    assert(rec && "Entity does not exist!");
+    items[i] = (batch_item){rec->arch, rec->row, entts[i]};
+  }
+  qsort(items, n, sizeof(batch_item), compare_batch_items);
+
+  gid     *group_entts = malloc(sizeof(gid) * n);
+  int64_t *group_rows = malloc(sizeof(int64_t) * n);
+  for (int64_t start = 0, end = 0; start < n; start = end) {
+    archetype *from = items[start].arch;
+    for (end = start; end < n && items[end].arch == from; end++) {
+      assert((end == start || items[end].entt != items[end - 1].entt) &&
+             "Entity appears twice in the batch!");
+      group_entts[end - start] = items[end].entt;
+      group_rows[end - start] = items[end].row;
+    }
+
+    archetype *to = transition_target(w, from, &delta, add);
+    archetype_move_rows(w, from, to, group_entts, group_rows, end - start);
+  }
+
+  free(group_rows);
+  free(group_entts);
+  free(items);
+  end_frame(w->allocator);
+}
 
-  /* Entities that were created concurrently dont yet exist on this list,
-     so all components will be in this context even if they match the
-     archetype */
-  if (!id_to_hash_has(&q->world_ctx->entity_registry, &entt))
-    return q->archetype_ctx->simulation;
+feach(collect_matching, kvpair, item, {
+  void       **list = args;
+  g_signature *signature = list[0];
+  cache_vec   *matches = list[1];
+  archetype   *arch = *(archetype **)item.value;
+  if (arch->length && signature_is_subset(&arch->signature, signature))
+    cache_vec_push(matches, (void **)&arch);
+});
+/* Move every entity holding the components in 'query' as whole archetypes. */
+static void component_matching(g_core *w, char *query, char *types,
+                               bool add) {
+  start_frame(w->allocator);
+  hash_vec query_types, delta;
+  archetype_key(query, &query_types);
+  archetype_key(types, &delta);
+
+  g_signature signature = {0};
+  for (int64_t i = 0; i < query_types.length; i++)
+    signature_set(&signature,
+                  component_intern(*hash_vec_at(&query_types, i)));
+
+  /* Collect first, moving rows creates archetypes in the registry */
+  cache_vec matches;
+  cache_vec_sinit(&matches, 16);
+  void *args[2];
+  args[0] = &signature;
+  args[1] = &matches;
+  hash_to_archetype_foreach(&w->archetype_registry, collect_matching, args);
+
+  for (int64_t i = 0; i < matches.length; i++) {
+    archetype *from = *cache_vec_at(&matches, i);
+    if (has_all_types(from, &delta) == add) continue;
+
+    int64_t  n = from->length;
+    gid     *entts = malloc(sizeof(gid) * n);
+    int64_t *rows = malloc(sizeof(int64_t) * n);
+    for (int64_t row = 0; row < n; row++) {
+      entts[row] = *id_vec_at(&from->row_entities, row);
+      rows[row] = row;
+    }
 
-  return ctx;
+    archetype *to = transition_target(w, from, &delta, add);
+    archetype_move_rows(w, from, to, entts, rows, n);
+    free(rows);
+    free(entts);
+  }
+
+  end_frame(w->allocator);
 }
 
 /*-------------------------------------------------------
  * Thread Unsafe Internal Component Operations
  *-------------------------------------------------------*/
-feach(push_to_types, kvpair, item, {
-  hash_vec *type_list = args;
-  gid      *id = item.key;
-  hash_vec_push(type_list, id);
-});
-static compare(sort_hashes, gid, a, b, { return a < b; });
+g_cid component_intern(uint64_t type) {
+  pthread_mutex_lock(&cid_lock);
+  if (!cid_allocator) {
+    cid_allocator = stalloc_create(STALLOC_DEFAULT);
+    hash_to_size_inita(&cid_registry, cid_allocator, TO_HEAP,
+                       COMPONENT_REG_START);
+    size_vec_inita(&cid_alignment, cid_allocator, TO_HEAP,
+                   COMPONENT_REG_START);
+    size_vec_inita(&cid_size, cid_allocator, TO_HEAP, COMPONENT_REG_START);
+  }
+
+  gsize *id = hash_to_size_get(&cid_registry, &type).value;
+  g_cid  result;
+  if (id) {
+    result = *id;
+  } else {
+    gsize next = cid_registry.slots_in_use;
+    assert(next < G_MAX_COMPONENTS && "Raise G_MAX_COMPONENTS!");
+    gsize packed = 1; /* Unknown until declared with G_DECLARE */
+    hash_to_size_put(&cid_registry, &type, &next);
+    gsize unknown = 0;
+    size_vec_push(&cid_alignment, &packed);
+    size_vec_push(&cid_size, &unknown);
+    result = next;
+  }
+
+  pthread_mutex_unlock(&cid_lock);
+  return result;
+}
+
+gsize component_alignment(g_cid id) {
+  pthread_mutex_lock(&cid_lock);
+  gsize align = *size_vec_at(&cid_alignment, id);
+  pthread_mutex_unlock(&cid_lock);
+  return align;
+}
+
+gsize component_declared_size(g_cid id) {
+  pthread_mutex_lock(&cid_lock);
+  gsize size = *size_vec_at(&cid_size, id);
+  pthread_mutex_unlock(&cid_lock);
+  return size;
+}
+
 void _g_add_component(g_core *w, gid entt, hash_vec *type_list) {
   log_enter;
 
+  /* Repeated transitions follow the edge cached on the archetype */
+  uint64_t delta_key = EDGE_ADD_KEY(type_list);
+  if (edge_transition(w, entt, type_list, true)) {
+    log_leave;
+    return;
+  }
+
   archetype *entt_arch = load_entity_archetype(w, entt);
 
   /* Assert all components in new_types are unique. We only do this check if
@@ -58,6 +242,7 @@ void _g_add_component(g_core *w, gid entt, hash_vec *type_list) {
     hash_vec_sort(type_list, sort_hashes, NULL);
   }
   delta_transition(w, entt, type_list);
+  edge_remember(entt_arch, delta_key, load_entity_archetype(w, entt));
 
   log_leave;
 }
@@ -65,66 +250,63 @@ void _g_add_component(g_core *w, gid entt, hash_vec *type_list) {
 void *_g_get_component(g_core *w, gid entt, gid type) {
   log_enter;
 
-  /* Load the archetype the entity exists in */
-  archetype *entt_archetype = load_entity_archetype(w, entt);
-
-  /* Load the position of the entities components in the composite. No assert is
-     needed because load_entity_archetype will assert entt for us. */
-  int64_t *entt_pos =
-      id_to_int64_get(&entt_archetype->entt_positions, &entt).value;
+  /* Load where the entity is stored */
+  entity_record *rec = entity_lookup(&w->entity_registry, entt);
+  assert(rec && "Entity does not exist!");
 
-  /* Load the position of the component in the composite */
-  gsize *offset = hash_to_size_get(&entt_archetype->offsets, &type).value;
-  assert(offset && "Given type does not exist on this archetype!");
+  /* Load the column the component is stored in */
+  int64_t col = archetype_column(rec->arch, type);
+  assert(col != -1 && "Given type does not exist on this archetype!");
 
   /* Return the pointer to the spot the component exists in */
-  cbuff buff;
-  buff_init(&buff, vec_at(&entt_archetype->components, *entt_pos));
-
   log_leave;
-  return buff_skip(&buff, *offset);
+  return archetype_field(rec->arch, rec->row, col);
 }
 
 void _g_set_component(g_core *w, gid entt, gid type, void *comp_data) {
   log_enter;
 
-  /* Load the archetype the entity exists in */
-  archetype *entt_archetype = load_entity_archetype(w, entt);
-
-  /* Load the position of the entities components in the composite */
-  int64_t *entt_pos =
-      id_to_int64_get(&entt_archetype->entt_positions, &entt).value;
+  /* Load where the entity is stored */
+  entity_record *rec = entity_lookup(&w->entity_registry, entt);
+  assert(rec && "Entity does not exist!");
 
-  /* Load the position of the component in the composite */
-  gsize *offset = hash_to_size_get(&entt_archetype->offsets, &type).value;
-  gsize *comp_size = hash_to_size_get(&w->component_registry, &type).value;
-  assert(offset && "Given type does not exist on this archetype!");
+  /* Load the column the component is stored in */
+  int64_t col = archetype_column(rec->arch, type);
+  assert(col != -1 && "Given type does not exist on this archetype!");
 
-  /* Get the address of the component within the composite and overwrite */
-  cbuff buff;
-  buff_init(&buff, vec_at(&entt_archetype->components, *entt_pos));
-  memmove(buff_skip(&buff, *offset), comp_data, *comp_size);
+  /* Get the address of the component within the storage and overwrite */
+  memmove(archetype_field(rec->arch, rec->row, col), comp_data,
+          column_vec_at(&rec->arch->columns, col)->size);
 
   log_leave;
 }
 
 bool _g_has_component(g_core *w, gid entt, gid type) {
-  log_enter;
-  gid *archetype_id = id_to_hash_get(&w->entity_registry, &entt).value;
-  if (!archetype_id) return false;
-
-  archetype *arch =
-      hash_to_archetype_get(&w->archetype_registry, archetype_id).value;
-  if (!arch) false;
-  log_leave;
+  entity_record *rec = entity_lookup(&w->entity_registry, entt);
+  if (!rec) return false;
 
   /* Check if entities archetype has 'type' */
-  return hash_to_size_get(&arch->offsets, &type).value != NULL;
+  return archetype_column(rec->arch, type) != -1;
 }
 
 /*-------------------------------------------------------
  * Thread Unsafe Component Operations
  *-------------------------------------------------------*/
+g_cid g_component_id(char *name) {
+  return component_intern(hash_mem(name, strlen(name)));
+}
+
+g_cid g_declare_component(char *name, size_t size, size_t align) {
+  g_cid id = g_component_id(name);
+  log_debug("declared component: %s -> %ld (%ld bytes)", name, id, size);
+
+  pthread_mutex_lock(&cid_lock);
+  *size_vec_at(&cid_alignment, id) = align;
+  *size_vec_at(&cid_size, id) = size;
+  pthread_mutex_unlock(&cid_lock);
+  return id;
+}
+
 void g_add_component(g_core *w, gid entt, char *new_types) {
   log_enter;
   start_frame(w->allocator);
@@ -135,39 +317,69 @@ void g_add_component(g_core *w, gid entt, char *new_types) {
   log_leave;
 }
 
+/* Stamp component 'type' of 'entt' as written, systems with a CHANGED term
+   on it pick the entity up on their next run. */
+static void mark_written(g_core *w, gid entt, gid type) {
+  entity_record *rec = entity_lookup(&w->entity_registry, entt);
+  archetype_stamp_write(rec->arch, archetype_column(rec->arch, type),
+                        rec->row, archetype_next_tick(w));
+}
+
+/* Stamp component 'type' of 'entt' as written if the system running 'q'
+   declares writing it, otherwise getting it through the query is a read. */
+static void mark_declared(g_query *q, gid entt, gid type) {
+  if (!q->system_ctx) return;
+  entity_record *rec = entity_lookup(&q->world_ctx->entity_registry, entt);
+  int64_t        col = archetype_column(rec->arch, type);
+  g_cid          id = column_vec_at(&rec->arch->columns, col)->id;
+  if (!signature_has(&q->system_ctx->writes, id)) return;
+  archetype_stamp_write(rec->arch, col, rec->row,
+                        archetype_next_tick(q->world_ctx));
+}
+
 void *g_get_component(g_core *w, gid entt_id, char *name) {
   log_enter;
-  void *comp =
-      _g_get_component(w, entt_id, (gid)hash_bytes(name, strlen(name)));
+  gid   type = (gid)hash_mem(name, strlen(name));
+  void *comp = _g_get_component(w, entt_id, type);
   log_leave;
   return comp;
 }
 
 void g_set_component(g_core *w, gid entt, char *name, void *comp) {
   log_enter;
-  _g_set_component(w, entt, (gid)hash_bytes(name, strlen(name)), comp);
+  gid type = (gid)hash_mem(name, strlen(name));
+  _g_set_component(w, entt, type, comp);
+  mark_written(w, entt, type);
   log_leave;
 }
 
 bool g_has_component(g_core *w, gid entt, char *name) {
   log_enter;
   log_leave;
-  return _g_has_component(w, entt, (gid)hash_bytes(name, strlen(name)));
+  return _g_has_component(w, entt, (gid)hash_mem(name, strlen(name)));
 }
 
 void g_rem_component(g_core *w, gid entt, char *remove_types) {
   log_enter;
   start_frame(w->allocator);
 
-  /* Load the current entities archetype */
-  archetype *entt_archetype = load_entity_archetype(w, entt);
-
   hash_vec rem_types;
   archetype_key(remove_types, &rem_types);
 
+  /* Repeated transitions follow the edge cached on the archetype */
+  uint64_t delta_key = EDGE_REM_KEY(&rem_types);
+  if (edge_transition(w, entt, &rem_types, false)) {
+    end_frame(w->allocator);
+    log_leave;
+    return;
+  }
+
+  /* Load the current entities archetype */
+  archetype *entt_archetype = load_entity_archetype(w, entt);
+
   /* Remove all types in rem_types from a copy of the entities type_set */
   type_set retained_types;
-  type_set_copy(&entt_archetype->types, &retained_types);
+  type_set_copy(&retained_types, &entt_archetype->types);
 
   for (int64_t i = 0; i < rem_types.length; i++) {
     gid *comp_id = hash_vec_at(&rem_types, i);
@@ -180,85 +392,100 @@ void g_rem_component(g_core *w, gid entt, char *remove_types) {
   // TODO: I do not like this. Fix it
   hash_vec transition_typelist;
   set_to_vec((set *)&retained_types, (vec *)&transition_typelist);
+  hash_vec_sort(&transition_typelist, sort_hashes, NULL);
 
   delta_transition(w, entt, &transition_typelist);
+  edge_remember(entt_archetype, delta_key, load_entity_archetype(w, entt));
 
   end_frame(w->allocator);
   log_leave;
 }
 
+void g_add_component_batch(g_core *w, gid *entts, int64_t n, char *types) {
+  log_enter;
+  component_batch(w, entts, n, types, true);
+  log_leave;
+}
+
+void g_rem_component_batch(g_core *w, gid *entts, int64_t n, char *types) {
+  log_enter;
+  component_batch(w, entts, n, types, false);
+  log_leave;
+}
+
+void g_add_component_matching(g_core *w, char *query, char *types) {
+  log_enter;
+  component_matching(w, query, types, true);
+  log_leave;
+}
+
+void g_rem_component_matching(g_core *w, char *query, char *types) {
+  log_enter;
+  component_matching(w, query, types, false);
+  log_leave;
+}
+
 /*-------------------------------------------------------
  * Thread Safe Component Operations
  *-------------------------------------------------------*/
 void __gq_add(g_query *q, gid entt, char *name) {
-  /* Regardless of where the component exists. This transition must be
-     simulated because it is not possible to parallelize. */
+  /* Regardless of where the component exists. The transition is recorded
+     and happens at the end of the tick because it is not possible to
+     parallelize. */
   if (!q->archetype_ctx) return g_add_component(q->world_ctx, entt, name);
-  return g_add_component(q->archetype_ctx->simulation, entt, name);
-}
-
-void __gq_mut(g_query *q, gid entt) {
-  id_vec_push(&q->archetype_ctx->entt_mutation_buffer, &entt);
+  command_push(q->world_ctx, CMD_ADD, entt, hash_mem(name, strlen(name)),
+               NULL);
 }
 
 void *__gq_get(g_query *q, gid entt, char *name) {
   if (!q->archetype_ctx) return g_get_component(q->world_ctx, entt, name);
-  gid type_id = (gid)hash_bytes(name, strlen(name));
-  return g_get_component(select_component_location_ctx(q, entt, type_id), entt,
-                         name);
+  gid type_id = (gid)hash_mem(name, strlen(name));
+
+  /* Components in the real context are preferred, this is what keeps the
+     fragments vectorizable. Components added this tick live in the payload
+     of their command until the tick ends. */
+  if (_g_has_component(q->world_ctx, entt, type_id)) {
+    void *comp = _g_get_component(q->world_ctx, entt, type_id);
+    mark_declared(q, entt, type_id);
+    return comp;
+  }
+
+  command *cmd = NULL;
+  if (command_pending(q->world_ctx, entt))
+    cmd = command_last(q->world_ctx, entt, type_id);
+  assert(cmd && cmd->payload && "Component does not exist on this entity!");
+  return cmd->payload;
 }
 
 bool __gq_has(g_query *q, gid entt, char *name) {
   if (!q->archetype_ctx) return g_has_component(q->world_ctx, entt, name);
-  return g_has_component(q->world_ctx, entt, name) ||
-         g_has_component(q->archetype_ctx->simulation, entt, name);
+  gid type_id = (gid)hash_mem(name, strlen(name));
+
+  /* Entities without commands this tick answer from their archetype */
+  if (command_pending(q->world_ctx, entt)) {
+    command *cmd = command_last(q->world_ctx, entt, type_id);
+    if (cmd) return cmd->op == CMD_ADD || cmd->op == CMD_SET;
+  }
+  return _g_has_component(q->world_ctx, entt, type_id);
 }
 
 void __gq_set(g_query *q, gid entt, char *name, void *comp) {
   if (!q->archetype_ctx) return g_set_component(q->world_ctx, entt, name, comp);
-  gid type_id = (gid)hash_bytes(name, strlen(name));
-  return g_set_component(select_component_location_ctx(q, entt, type_id), entt,
-                         name, comp);
+  gid type_id = (gid)hash_mem(name, strlen(name));
+  if (_g_has_component(q->world_ctx, entt, type_id)) {
+    _g_set_component(q->world_ctx, entt, type_id, comp);
+    mark_written(q->world_ctx, entt, type_id);
+    return;
+  }
+  command_push(q->world_ctx, CMD_SET, entt, type_id, comp);
 }
 
 void __gq_rem(g_query *q, gid entt, char *name) {
-  /* Very tricky. Component removal makes a mess of things but nothing that
-     cannot be recovered from in the migration step.
-
-     There are two cases: our first time deleting on this entity or future
-     deletion.
-
-     First time case: For the first time, we transition ALL components EXCEPT
-     for the one specified for deletion. On the get/set steps, we always prefer
-     the components inside of the real context over simulation. This is
-     because it retains the vectorizability property.
-
-     Future cases: For future times, when the entity gets their component
-     deleted, we only need to transition the archetype in the simulation
-     context. */
+  /* Rows stay where they are until the end of the tick so systems iterating
+     the fragment are not disturbed. */
   if (!q->archetype_ctx) return g_rem_component(q->world_ctx, entt, name);
-  archetype *arch = q->archetype_ctx;
-  archetype *sim_arch = load_entity_archetype(arch->simulation, entt);
-  id_vec_push(&q->archetype_ctx->entt_mutation_buffer, &entt);
-
-  /* We check if this is the first time transitioning by seeing if the types
-     intersect. If they do intersect then this is not the first time deleting */
-  set inter_set;
-  set_intersect(&arch->types, &sim_arch->types, &inter_set);
-  if (set_length(&inter_set) > 0) {
-    return g_rem_component(arch->simulation, entt, name);
-  }
-
-  /* Transition into simulation only. NOTE: we take the union because we want to
-     retain whatever types are already in there. */
-  type_set transition_to;
-  type_set_union(&arch->types, &sim_arch->types, &transition_to);
-
-  hash_vec key;
-  set_to_vec(&transition_to, &key);
-  delta_transition(q->archetype_ctx->simulation, entt, &key);
-
-  return g_rem_component(q->archetype_ctx->simulation, entt, name);
+  command_push(q->world_ctx, CMD_REMOVE, entt, hash_mem(name, strlen(name)),
+               NULL);
 }
 
 int64_t gq_tick(g_query *q) { return q->world_ctx->tick; }
@@ -15,9 +15,20 @@
 
 #include "gecs.h"
 
+/* Return the dense id of the component hashed to 'type', handing out the
+   next free id on first sight. Thread safe. */
+g_cid component_intern(uint64_t type);
+
+/* Return the alignment component 'id' was declared with, 1 if the component
+   was never declared with G_DECLARE. Thread safe. */
+gsize component_alignment(g_cid id);
+
+/* Return the size component 'id' was declared with, 0 if the component was
+   never declared with G_DECLARE. Thread safe. */
+gsize component_declared_size(g_cid id);
+
 void  _g_add_component(g_core *w, gid entt, hash_vec *new_types);
 void *_g_get_component(g_core *w, gid entt, gid type);
 void  _g_set_component(g_core *w, gid entt, gid type, void *comp_data);
 bool  _g_has_component(g_core *w, gid entt, gid type);
-void  __gq_mut(g_query *q, gid entt);
 #endif
\ No newline at end of file
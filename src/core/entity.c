@@ -1,18 +1,93 @@
 #include "archetype.h"
+#include "command.h"
+#include "component.h"
 #include "gecs.h"
+#include "entity.h"
 #include "gid.h"
+#include <stdio.h>
 
 /*-------------------------------------------------------
  * Static Entity Functions
  *-------------------------------------------------------*/
-static gid create_entity_using_idgen(g_core *w, atomic_uint_least64_t *idgen) {
+#define FREE_INDEX(head)      (uint32_t)((head) & 0xFFFFFFFF)
+#define FREE_TAG(head)        (uint32_t)((head) >> 32)
+#define FREE_PACK(tag, index) (((uint64_t)(tag) << 32) | (uint32_t)(index))
+
+static void init_page(entity_record *page, uint64_t page_no) {
+  /* Unused records hold the first handle of their index, marked dead */
+  for (int64_t i = 0; i < ENTITY_PAGE_SIZE; i++) {
+    page[i].id = GID_MAKE(page_no * ENTITY_PAGE_SIZE + i, 0, DEL);
+    page[i].arch = NULL;
+    page[i].row = 0;
+    page[i].pending = 0;
+  }
+}
+
+/* Return the record at 'index', allocating its page if needed. Not thread
+   safe. */
+static entity_record *entity_slot(entity_index *ix, uint64_t index) {
+  uint64_t page = index / ENTITY_PAGE_SIZE;
+
+  /* Grow the page table to fit, doubling to amortize */
+  if (page >= (uint64_t)ix->page_count) {
+    int64_t count = ix->page_count;
+    while ((uint64_t)count <= page)
+      count *= 2;
+    ix->pages = realloc(ix->pages, count * sizeof(entity_record *));
+    memset(ix->pages + ix->page_count, 0,
+           (count - ix->page_count) * sizeof(entity_record *));
+    ix->page_count = count;
+  }
+
+  if (!ix->pages[page]) {
+    ix->pages[page] = malloc(ENTITY_PAGE_SIZE * sizeof(entity_record));
+    init_page(ix->pages[page], page);
+  }
+
+  return &ix->pages[page][index % ENTITY_PAGE_SIZE];
+}
+
+/* Pop a released index off the free list of 'w' and return its next handle.
+   Returns 0 when nothing can be recycled. Lock free, the records of 'w' are
+   only read. */
+static gid free_list_pop(g_core *w) {
+  uint64_t head = atomic_load(&w->free_ids);
+  while (FREE_INDEX(head)) {
+    uint64_t       index = FREE_INDEX(head);
+    entity_record *rec = &w->entity_registry.pages[index / ENTITY_PAGE_SIZE]
+                                                  [index % ENTITY_PAGE_SIZE];
+    uint64_t next = FREE_PACK(FREE_TAG(head) + 1, rec->row);
+    if (atomic_compare_exchange_weak(&w->free_ids, &head, next))
+      return GID_MAKE(index, SELECT_GEN(rec->id), ALV);
+  }
+  return 0;
+}
+
+static void free_list_push(g_core *w, uint64_t index) {
+  entity_record *rec = entity_slot(&w->entity_registry, index);
+  uint64_t       head = atomic_load(&w->free_ids);
+  uint64_t       next;
+  do {
+    rec->row = FREE_INDEX(head);
+    next = FREE_PACK(FREE_TAG(head) + 1, index);
+  } while (!atomic_compare_exchange_weak(&w->free_ids, &head, next));
+}
+
+/* Hand out an entity id of 'source'. Released indices are reused before new
+   ones are generated. */
+static gid next_entity_id(g_core *source) {
+  gid id = free_list_pop(source);
+  return id ? id : gid_atomic_incr(&source->id_gen);
+}
+
+static gid create_entity(g_core *w) {
   log_enter;
 
-  gid id = gid_atomic_incr(idgen);
+  gid id = next_entity_id(w);
 
   /* All entities initially start at the empty archetype. This is simulated
      as such: */
-  id_to_hash_put(&w->entity_registry, &id, &empty_archetype.hash_name);
+  entity_insert(&w->entity_registry, id);
 
   log_leave;
   return id;
@@ -22,18 +97,54 @@ static gid create_entity_using_idgen(g_core *w, atomic_uint_least64_t *idgen) {
  * Internal GECS Library Functions
  *-------------------------------------------------------*/
 archetype *load_entity_archetype(g_core *w, gid entt) {
-  log_enter;
+  entity_record *rec = entity_lookup(&w->entity_registry, entt);
+  assert(rec && "Entity does not exist!");
+  return rec->arch;
+}
 
-  /* Load archtype hash name */
-  gid *archetype_id = id_to_hash_get(&w->entity_registry, &entt).value;
-  assert(archetype_id && "Entity does not exist!");
+bool entity_exists(g_core *w, gid entt) {
+  return entity_lookup(&w->entity_registry, entt) != NULL;
+}
 
-  /* Load archetype */
-  archetype *arch =
-      hash_to_archetype_get(&w->archetype_registry, archetype_id).value;
-  if (!arch) return &empty_archetype;
-  return arch;
-  log_leave;
+/*-------------------------------------------------------
+ * Entity Index Operations
+ *-------------------------------------------------------*/
+void entity_release(g_core *w, gid entt) {
+  entity_record *rec = entity_slot(&w->entity_registry, SELECT_ID(entt));
+
+  /* Handles released twice or already recycled are ignored */
+  if (SELECT_GEN(rec->id) != SELECT_GEN(entt)) return;
+  rec->arch = NULL;
+  rec->id = GID_NEXT_GEN(entt);
+  free_list_push(w, SELECT_ID(entt));
+}
+
+void entity_index_init(entity_index *ix) {
+  ix->page_count = ENTITY_REG_START;
+  ix->pages = calloc(ix->page_count, sizeof(entity_record *));
+}
+
+void entity_index_free(entity_index *ix) {
+  for (int64_t i = 0; i < ix->page_count; i++)
+    free(ix->pages[i]);
+  free(ix->pages);
+}
+
+entity_record *entity_lookup(entity_index *ix, gid entt) {
+  uint64_t idx = SELECT_ID(entt);
+  uint64_t page = idx / ENTITY_PAGE_SIZE;
+  if (page >= (uint64_t)ix->page_count || !ix->pages[page]) return NULL;
+
+  entity_record *rec = &ix->pages[page][idx % ENTITY_PAGE_SIZE];
+  return rec->id == entt ? rec : NULL;
+}
+
+entity_record *entity_insert(entity_index *ix, gid entt) {
+  entity_record *rec = entity_slot(ix, SELECT_ID(entt));
+  rec->id = entt;
+  rec->arch = &empty_archetype;
+  rec->row = -1;
+  return rec;
 }
 
 /*-------------------------------------------------------
@@ -41,24 +152,79 @@ archetype *load_entity_archetype(g_core *w, gid entt) {
  *-------------------------------------------------------*/
 gid g_create_entity(g_core *w) {
   log_enter;
-  gid id = create_entity_using_idgen(w, &w->id_gen);
+  gid id = create_entity(w);
   G_ADD_COMPONENT(w, id, GecID);
   G_SET_COMPONENT(w, id, GecID, {.id = id});
   log_leave;
   return id;
 }
 
-void g_mark_delete(g_core *w, gid entt) {
+/* Register the 'n' rows of 'a' starting at 'row' as the entities 'ids' and
+   fill in their GecID. */
+static void register_rows(g_core *w, archetype *a, int64_t row, gid *ids,
+                          int64_t n) {
+  uint64_t id_type = hash_mem("GecID", 5);
+  int64_t  id_col = archetype_column(a, id_type);
+  for (int64_t i = 0; i < n; i++) {
+    entity_record *rec = entity_insert(&w->entity_registry, ids[i]);
+    rec->arch = a;
+    rec->row = row + i;
+    ((GecID *)archetype_field(a, row + i, id_col))->id = ids[i];
+  }
+}
+
+void g_create_entities(g_core *w, int64_t n, char *types, gid *out_ids) {
   log_enter;
+  assert(out_ids && "g_create_entities needs room for the new ids!");
+  start_frame(w->allocator);
 
-  archetype *arch = load_entity_archetype(w, entt);
-  if (arch == &empty_archetype) {
-    id_to_hash_del(&w->entity_registry, &entt);
-    return;
-  }
+  /* Resolve the destination once, every entity lands there directly */
+  char *full = stpush(strlen(types) + 8);
+  sprintf(full, "GecID, %s", types);
+  hash_vec key;
+  archetype_key(full, &key);
+  archetype *a = archetype_resolve(w, &key);
+
+  for (int64_t i = 0; i < n; i++)
+    out_ids[i] = next_entity_id(w);
+
+  int64_t row = archetype_push_rows(a, out_ids, n);
+  archetype_stamp_rows(&empty_archetype, NULL, a, row, n,
+                       archetype_next_tick(w));
+  register_rows(w, a, row, out_ids, n);
+
+  end_frame(w->allocator);
+  log_leave;
+}
+
+void g_clone_entities(g_core *w, gid prototype, int64_t n, gid *out_ids) {
+  log_enter;
+  assert(out_ids && "g_clone_entities needs room for the new ids!");
+
+  archetype *a = load_entity_archetype(w, prototype);
+  assert(a != &empty_archetype && "Prototype has no components!");
 
-  id_to_hash_del(&arch->entt_positions, &entt);
-  id_vec_push(&arch->entt_deletion_buffer, &entt);
+  for (int64_t i = 0; i < n; i++)
+    out_ids[i] = next_entity_id(w);
+
+  /* Rows are only appended, the prototype row stays where it is */
+  int64_t src = entity_lookup(&w->entity_registry, prototype)->row;
+  int64_t row = archetype_push_rows(a, out_ids, n);
+  for (int64_t i = 0; i < n; i++)
+    archetype_move_row(a, row + i, src);
+  archetype_stamp_rows(&empty_archetype, NULL, a, row, n,
+                       archetype_next_tick(w));
+  register_rows(w, a, row, out_ids, n);
+
+  log_leave;
+}
+
+void g_mark_delete(g_core *w, gid entt) {
+  log_enter;
+  assert(entity_exists(w, entt) && "Entity marked to delete does not exist!");
+
+  /* The row is removed at the end of the tick */
+  command_push(w, CMD_DESTROY, entt, 0, NULL);
 
   log_leave;
 }
@@ -70,12 +236,11 @@ void g_mark_delete(g_core *w, gid entt) {
 gid gq_create_entity(g_query *q) {
   log_enter;
 
-  /* We use the idgen from world as the id gen in the simulation to keep the
-     IDs consistent. This is ok because idgen is made to be thread safe. */
-  gid id = create_entity_using_idgen(q->archetype_ctx->simulation,
-                                     &q->world_ctx->id_gen);
-
-  id_vec_push(&q->archetype_ctx->entt_creation_buffer, &id);
+  /* The id is handed out right away, this is ok because both the free list
+     and idgen are made to be thread safe. The entity itself only appears in
+     the world at the end of the tick. */
+  gid id = next_entity_id(q->world_ctx);
+  command_push(q->world_ctx, CMD_CREATE, id, 0, NULL);
 
   log_leave;
   return id;
@@ -83,41 +248,31 @@ gid gq_create_entity(g_query *q) {
 
 /* Add an entity `entt` to the delete queue */
 void gq_mark_delete(g_query *q, gid entt) {
-  /* Find where entt exists. There are two positions it may live in: world or
-     simulation */
-  if (id_to_hash_has(&q->world_ctx->entity_registry, &entt)) {
-    g_mark_delete(q->world_ctx, entt);
-    return;
-  }
-
-  if (id_to_hash_has(&q->archetype_ctx->simulation->entity_registry, &entt)) {
-    g_mark_delete(q->archetype_ctx->simulation, entt);
-    return;
-  }
-
-  assert(false && "Entity marked to delete does not exist!");
+  assert(gq_id_in(q, entt) && "Entity marked to delete does not exist!");
+  command_push(q->world_ctx, CMD_DESTROY, entt, 0, NULL);
 }
 
 /* Check if a given entity `id` is currently processable by this system. */
 bool gq_id_in(g_query *q, gid id) {
   log_enter;
 
-  /* Check if in the world, else check if in the simulation */
-  return id_to_hash_has(&q->world_ctx->entity_registry, &id) ||
-         id_to_hash_has(&q->archetype_ctx->simulation->entity_registry, &id);
+  /* Check if in the world, else check if created this tick */
+  return entity_exists(q->world_ctx, id) || command_created(q->world_ctx, id);
 
   log_leave;
 }
 
 bool gq_id_alive(g_query *q, gid id) {
-  return id_to_hash_has(&q->world_ctx->entity_registry, &id);
+  return entity_exists(q->world_ctx, id);
 }
 
 void *__gq_field_by_id(g_query *q, gid entt, char *type) {
   /* This is a guard to retain valid concurrency.  */
-  int64_t *pos =
-      id_to_int64_get(&q->archetype_ctx->entt_positions, &entt).value;
-  assert(pos && "Entity does not exist on this archetype!");
+  entity_record *rec = entity_lookup(&q->world_ctx->entity_registry, entt);
+  assert(rec && rec->arch == q->archetype_ctx &&
+         "Entity does not exist on this archetype!");
 
-  return g_get_component(q->world_ctx, entt, type);
+  /* The system stamps the columns it declares writing once it ran */
+  return _g_get_component(q->world_ctx, entt,
+                          (gid)hash_mem(type, strlen(type)));
 }
\ No newline at end of file
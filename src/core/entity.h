@@ -16,4 +16,23 @@
 
 archetype *load_entity_archetype(g_core *w, gid entt);
 
+/* Check if 'entt' exists in the world 'w'. */
+bool entity_exists(g_core *w, gid entt);
+
+/* Remove 'entt' from 'w' and hand its index out again under the next
+   generation. Stale or repeated releases are ignored. Not thread safe. */
+void entity_release(g_core *w, gid entt);
+
+/* Initialize an empty entity index 'ix'. */
+void entity_index_init(entity_index *ix);
+
+/* Free every page of 'ix'. */
+void entity_index_free(entity_index *ix);
+
+/* Find the record of 'entt'. Returns NULL if 'entt' is not inside 'ix'. */
+entity_record *entity_lookup(entity_index *ix, gid entt);
+
+/* Add 'entt' to 'ix' inside the empty archetype and return its record. */
+entity_record *entity_insert(entity_index *ix, gid entt);
+
 #endif
\ No newline at end of file
@@ -1,217 +1,16 @@
 #include "gecs.h"
 #include "archetype.h"
+#include "chunk.h"
+#include "command.h"
 #include "component.h"
 #include "entity.h"
 #include "gid.h"
+#include "matcher.h"
+#include "scheduler.h"
+#include "signature.h"
+#include <ctype.h>
 #include <stdio.h>
 
-/*-------------------------------------------------------
- * Static Functions
- *-------------------------------------------------------*/
-static void archetype_simulate_deletions(g_core *w, archetype *a) {
-  /* Deletion Algorithm:
-       - For each entity in the delete buffer
-       - Pop
-       - Delete entity links in the registry
-       - Delete entity links in the simulation registry if exists */
-  while (a->entt_deletion_buffer.length) {
-    gid *entt = id_vec_top(&a->entt_deletion_buffer);
-    id_vec_pop(&a->entt_deletion_buffer);
-
-    id_to_hash_del(&w->entity_registry, entt);
-    id_to_int64_del(&a->entt_positions, entt);
-    id_to_hash_del(&a->simulation->entity_registry, entt);
-  }
-}
-
-static void archetype_simulate_creations(g_core *w, archetype *a) {
-  /* Creation Algorithm:
-       - For each entity in the creation buffer
-       - Pop
-       - Load the entity archetype inside the simulation
-       - Perform component data transition from the simulation to
-       - the real context */
-
-  while (a->entt_creation_buffer.length) {
-    gid *entt = id_vec_top(&a->entt_creation_buffer);
-    id_vec_pop(&a->entt_creation_buffer);
-
-    /* This check is to ensure that the entity was not deleted by the simulate
-       deletion algorithm since it runs first. */
-    if (id_to_hash_has(&w->entity_registry, entt)) continue;
-
-    /* Offically add the entity to the map */
-    map_put(&w->entity_registry, entt, &empty_archetype.hash_name);
-    G_ADD_COMPONENT(w, *entt, GecID);
-    G_SET_COMPONENT(w, *entt, GecID, {.id = *entt});
-
-    /* Load simulated archetype */
-    archetype *sim_arch = load_entity_archetype(a->simulation, *entt);
-    hash_vec   types;
-    set_to_vec(&sim_arch->types, (hash_vec *)&types);
-    _g_add_component(w, *entt, &types);
-
-    /* Perform component data transition */
-    // TODO: This is an optimization opportunity. It's possible to directly
-    //       do a memmove instead of using get_component and set_component
-    for (int64_t type_i = 0; type_i < types.length; type_i++) {
-      gid *type = hash_vec_at(&types, type_i);
-      if (_g_has_component(a->simulation, *entt, *type)) {
-        void *seg = _g_get_component(a->simulation, *entt, *type);
-        _g_set_component(w, *entt, *type, seg);
-      }
-    }
-  }
-}
-
-static void entity_simulate_component_operations(g_core *w, archetype *a) {
-  /* Entity Consolidation Algorithm:
-        - For each entity in the mutation buffer
-        - Pop
-        - Load both simulated and real archetypes
-        - Take the type difference
-        - Move types in the difference to the real context */
-  while (a->entt_mutation_buffer.length) {
-    gid *entt = id_vec_top(&a->entt_mutation_buffer);
-    id_vec_pop(&a->entt_mutation_buffer);
-
-    /* This check is to ensure that the entity was not deleted by the simulate
-    deletion algorithm since it runs first. */
-    if (id_to_hash_has(&w->entity_registry, entt)) continue;
-
-    /* Load archetypes */
-    archetype *real_arch = load_entity_archetype(w, *entt);
-    archetype *sim_arch = load_entity_archetype(a->simulation, *entt);
-
-    /* Transition to where the tick simulated the entity will go */
-    hash_vec types;
-    set_to_vec(&sim_arch->types, (hash_vec *)&types);
-    delta_transition(w, *entt, &types);
-
-    /* All data in the real context is more fresh than the data in the
-       simulated context. So we only move the *new* component data from
-       simulated to real. */
-    // TODO: This is also an optimization opportunity for the same reason as
-    //       in `archetype_simulate_creations`
-    for (int64_t type_i = 0; type_i < types.length; type_i++) {
-      gid *type = hash_vec_at(&types, type_i);
-
-      /* Non simulated components are preferred. */
-      if (type_set_has(&real_arch->types, type)) continue;
-
-      void *new_seg = _g_get_component(a->simulation, *entt, *type);
-      _g_set_component(w, *entt, *type, new_seg);
-    }
-  }
-}
-
-feach(migrate_archetype, kvpair, item, {
-  g_core *w = (g_core *)args;
-  archetype_simulate_deletions(w, item.value);
-  archetype_simulate_creations(w, item.value);
-  entity_simulate_component_operations(w, item.value);
-});
-static void migration_routine(g_core *w) {
-  log_enter;
-
-  /* Entity FSM migration to real context routine. */
-  hash_to_archetype_foreach(&w->archetype_registry, migrate_archetype, w);
-
-  log_leave;
-}
-
-feach(reset_archetype, kvpair, item, {
-  archetype *arch = item.value;
-  composite_clear(&arch->components);
-  id_to_int64_clear(&arch->entt_positions);
-});
-feach(cleanup_archetype, kvpair, item, {
-  archetype *arch = item.value;
-
-  id_vec_clear(&arch->entt_creation_buffer);
-  id_vec_clear(&arch->entt_deletion_buffer);
-  id_vec_clear(&arch->entt_mutation_buffer);
-  id_to_hash_clear(&arch->simulation->entity_registry);
-  hash_to_archetype_foreach(&arch->simulation->archetype_registry,
-                            reset_archetype, NULL);
-});
-static void cleanup_routine(g_core *w) {
-  hash_to_archetype_foreach(&w->archetype_registry, cleanup_archetype, w);
-}
-
-feach(defrag_entity, kvpair, item, {
-  int64_vec *rolling_offsets = (int64_vec *)args;
-  int64_t   *pos = item.value;
-  *pos -= *int64_vec_at(rolling_offsets, *pos);
-});
-
-feach(defrag_archetype, kvpair, item, {
-  archetype *arch = item.value;
-  if (arch->components.length == 0) return;
-
-  composite vectorizor;
-  __vec_init(&vectorizor, arch->components.__el_size, arch->allocator, TO_HEAP,
-             arch->components.length);
-
-  int64_vec rolling_offsets;
-  int64_vec_sinit(&rolling_offsets, arch->components.length);
-  int64_t dead_index = 0;
-  for (int64_t i = 0; i < arch->components.length; i++) {
-    if (dead_index < arch->dead_fragment_buffer.length &&
-        *int64_vec_at(&arch->dead_fragment_buffer, dead_index) == i) {
-      dead_index++;
-      int64_vec_push(&rolling_offsets, &dead_index);
-      continue;
-    }
-    void *seg = composite_at(&arch->components, i);
-    composite_push(&vectorizor, seg);
-    int64_vec_push(&rolling_offsets, &dead_index);
-  }
-
-  /* Rewire vectorizer and components. Since vectorizer is stack allocated,
-     we need to recycle the composite address pointer and memove the cleaned
-     dataset from vectorizer to components to it. */
-  memmove(arch->components.elements, vectorizor.elements,
-          vectorizor.length * vectorizor.__el_size);
-  void *old_elements = vectorizor.elements;
-
-  vectorizor.elements = arch->components.elements;
-  memmove(&arch->components, &vectorizor, sizeof(composite));
-
-  vectorizor.elements = old_elements;
-  composite_free(&vectorizor);
-
-  id_to_int64_foreach(&arch->entt_positions, defrag_entity, &rolling_offsets);
-});
-
-static void defragment_routine(g_core *w) {
-  hash_to_archetype_foreach(&w->archetype_registry, defrag_archetype, NULL);
-}
-
-feach(process_archetype_fsm, kvpair, archetype_item, {
-  archetype *arch = archetype_item.value;
-  g_core    *w = (g_core *)args;
-
-  /* Clear the old contenders from the list */
-  system_vec_clear(&arch->contenders);
-
-  /* Iterate over each system and apply each system that intersects on
-     their type sets. */
-  for (int64_t i = 0; i < w->system_registry.length; i++) {
-    system_data *sys = system_vec_at(&w->system_registry, i);
-    if (set_is_subset(&arch->types, &sys->requirements)) {
-      system_vec_push(&arch->contenders, sys);
-    }
-  }
-});
-static void reassign_entity_fsm(g_core *w) {
-  log_enter;
-  hash_to_archetype_foreach(&w->archetype_registry, process_archetype_fsm, w);
-  /* Set process flag as complete so we don't re-process. */
-  w->invalidate_fsm = 0;
-  log_leave;
-}
-
 /*-------------------------------------------------------
  * Container Operations
  *-------------------------------------------------------*/
@@ -221,23 +20,44 @@ g_core *g_create_world(void) {
   g_core *w = calloc(1, sizeof(*w));
 
   atomic_init(&w->id_gen, 0);
+  atomic_init(&w->archetype_ids, 0);
+  atomic_init(&w->free_ids, 0);
+  atomic_init(&w->change_tick, 0);
+  atomic_init(&w->command_epoch, 0);
+  w->command_round = 1;
   gid_atomic_set(&w->id_gen, STORAGE);
 
-  w->invalidate_fsm = 1;
   w->is_sequential = 1;
   w->disable_concurrency = 0;
   w->tick = 0;
 
+  w->thread_count = scheduler_core_count();
+  w->workers = NULL;
+  w->each_grain_size = EACH_GRAIN_DEFAULT;
+  w->each_serial_threshold = EACH_SERIAL_DEFAULT;
+  w->storage_layout = G_LAYOUT_AOS;
+  w->retire_after = ARCHETYPE_RETIRE_DEFAULT;
+
   w->allocator = stalloc_create(STALLOC_DEFAULT);
 
   hash_to_archetype_inita(&w->archetype_registry, w->allocator, TO_HEAP,
                           ARCHETYPE_REG_START);
+  hash_to_size_inita(&w->registry_probes, w->allocator, TO_HEAP, 16);
   hash_to_size_inita(&w->component_registry, w->allocator, TO_HEAP,
                      COMPONENT_REG_START);
-  id_to_hash_inita(&w->entity_registry, w->allocator, TO_HEAP,
-                   ENTITY_REG_START);
+  entity_index_init(&w->entity_registry);
   system_vec_inita(&w->system_registry, w->allocator, TO_HEAP,
                    SYSTEM_REG_START);
+  hash_to_size_inita(&w->layout_registry, w->allocator, TO_HEAP, 16);
+  chunk_pool_init(&w->chunk_storage, w->allocator);
+  cache_vec_inita(&w->retired_archetypes, w->allocator, TO_HEAP,
+                  ARCHETYPE_POOL_SIZE);
+  matchers_init(w);
+
+  /* Outside of a tick only the calling thread records commands */
+  w->commands = NULL;
+  w->command_count = 0;
+  command_buffers_reserve(w, 1);
 
   /* Default component registrations */
   G_COMPONENT(w, GecID);
@@ -250,33 +70,34 @@ g_core *g_create_world(void) {
   return w;
 }
 
-feach(progress_archetype, kvpair, item, {
-  archetype *a = item.value;
-
-  /* Use this thread to process the archetype. So fast return */
-  if (a->belongs_to->disable_concurrency)
-    return archetype_perform_process(a->belongs_to, a);
-
-  /* Tracker used outside the thread of the process finished. Set this
-     first to avoid race conditions */
-  atomic_store(&a->thread_complete, false);
+static void archetype_job(task *t) {
+  archetype_perform_process(t->ctx[0], t->ctx[1], t->group);
+}
 
-  /* Set this to true and the thread will enter the process once. At the end
-     this sets thread_complete to true. */
-  atomic_store(&a->thread_in_process, true);
-});
-feach(sync_archetypes, kvpair, item, {
-  archetype *a = item.value;
-  /* No need to wait for anything */
-  if (a->belongs_to->disable_concurrency) {
+feach(progress_archetype, kvpair, item, {
+  void      **list = (void **)args;
+  g_core     *w = list[0];
+  task_group *tick_group = list[1];
+  cache_vec  *idle = list[2];
+  archetype  *a = *(archetype **)item.value;
+
+  /* Empty archetypes have nothing to process. Those that stay empty long
+     enough are retired once the tick is over. */
+  if (a->length == 0) {
+    if (!a->emptied_at) a->emptied_at = w->tick;
+    if (w->retire_after > 0 && w->tick - a->emptied_at >= w->retire_after)
+      cache_vec_push(idle, (void **)&a);
     return;
   }
+  a->emptied_at = 0;
+  if (!a->contenders.length) return;
 
-  /* Wait for each archetype to finish */
-  while (true) {
-    bool is_complete = atomic_load(&a->thread_complete);
-    if (is_complete) return;
-  }
+  /* Use this thread to process the archetype. So fast return */
+  if (w->disable_concurrency) return archetype_perform_process(w, a, NULL);
+
+  scheduler_submit(w->workers, &(task){.run = archetype_job,
+                                       .group = tick_group,
+                                       .ctx = {w, a}});
 });
 void g_progress(g_core *w) {
   start_frame(w->allocator);
@@ -284,38 +105,80 @@ void g_progress(g_core *w) {
   log_debug("TICK START");
 
   w->tick++;
-  if (w->invalidate_fsm == 1) reassign_entity_fsm(w);
 
-  /* Spin up or run the archetype */
-  map_foreach(&w->archetype_registry, progress_archetype, NULL);
+  /* The worker pool is created lazily so `thread_count` can be configured
+     after creating the world. */
+  if (!w->disable_concurrency && !w->workers) {
+    w->workers = scheduler_create(w->thread_count);
+    command_buffers_reserve(w, w->workers->thread_count);
+  }
+
+  /* Dispatch each archetype as a job onto the worker pool or run it */
+  task_group tick_group;
+  task_group_init(&tick_group);
+
+  cache_vec idle;
+  cache_vec_sinit(&idle, 16);
+
+  void *args[3];
+  args[0] = w;
+  args[1] = &tick_group;
+  args[2] = &idle;
 
-  /* Wait for each thread to finish its process and synchronize. This is
+  /* Commands recorded between ticks apply before those of systems */
+  command_fence(w);
+  map_foreach(&w->archetype_registry, progress_archetype, args);
+
+  /* Wait for each job to finish its process and synchronize. This is
      equivalent to performing a join */
-  map_foreach(&w->archetype_registry, sync_archetypes, NULL);
+  if (!w->disable_concurrency) scheduler_wait(w->workers, &tick_group);
+
+  /* Everything systems recorded lands in the world in one pass */
+  command_apply(w);
 
-  migration_routine(w);
-  cleanup_routine(w);
-  defragment_routine(w);
+  /* Retiring changes the registry, so it waits until nothing walks it. The
+     commands may have filled some of the idle archetypes again. */
+  for (int64_t i = 0; i < idle.length; i++) {
+    archetype *a = *cache_vec_at(&idle, i);
+    if (a->length == 0) archetype_retire(w, a);
+  }
 
   log_debug("TICK END");
   log_leave;
   end_frame(w->allocator);
 }
 
-feach(f_free_archetype, kvpair, item, { free_archetype(item.value); });
+feach(f_free_archetype, kvpair, item, {
+  archetype *arch = *(archetype **)item.value;
+  free_archetype(arch);
+  free(arch);
+});
 feach(f_free_system, system_data, sys, { type_set_free(&sys.requirements); });
 void g_destroy_world(g_core *w) {
   log_enter;
 
   hash_to_archetype_foreach(&w->archetype_registry, f_free_archetype, NULL);
   hash_to_archetype_free(&w->archetype_registry);
+  hash_to_size_free(&w->registry_probes);
+  for (int64_t i = 0; i < w->retired_archetypes.length; i++) {
+    archetype *arch = *cache_vec_at(&w->retired_archetypes, i);
+    free_archetype(arch);
+    free(arch);
+  }
+  cache_vec_free(&w->retired_archetypes);
 
   id_to_size_free(&w->component_registry);
 
   system_vec_foreach(&w->system_registry, f_free_system, NULL);
   system_vec_free(&w->system_registry);
+  matchers_free(w);
+
+  entity_index_free(&w->entity_registry);
+  hash_to_size_free(&w->layout_registry);
+  chunk_pool_free(&w->chunk_storage);
+  command_buffers_free(w);
 
-  id_to_hash_free(&w->entity_registry);
+  if (w->workers) scheduler_free(w->workers);
 
   stalloc_free(w->allocator);
   free(w);
@@ -326,52 +189,234 @@ void g_destroy_world(g_core *w) {
 /*-------------------------------------------------------
  * Thread Unsafe Registration Operations
  *-------------------------------------------------------*/
-void g_register_component(g_core *w, char *name, size_t component_size) {
+g_cid g_register_component(g_core *w, char *name, size_t component_size) {
   log_enter;
   start_frame(w->allocator);
 
-  uint64_t hash_name = hash_bytes(name, strlen(name));
+  uint64_t hash_name = hash_mem(name, strlen(name));
 
-  assert(!hash_to_size_has(&w->component_registry, name) &&
+  assert(!hash_to_size_has(&w->component_registry, &hash_name) &&
          "Collision detection: name is either re-registered or another "
          "component contains the same hashname. Exiting");
 
+  /* Declared components are laid out with their declared size */
+  g_cid id = component_intern(hash_name);
+  assert((!component_declared_size(id) ||
+          component_declared_size(id) == component_size) &&
+         "Component is registered with another size than it was declared!");
+
   hash_to_size_put(&w->component_registry, &hash_name, &component_size);
 
   log_debug("registerd new component: %s -> %ld", name, hash_name);
 
   end_frame(w->allocator);
   log_leave;
+  return id;
 }
 
-static feach(add_to_set, uint64_t, hash, {
-  type_set *types = args;
-  type_set_put(types, &hash);
-});
+void g_register_layout(g_core *w, int8_t layout, char *types) {
+  log_enter;
+  start_frame(w->allocator);
+  int8_t kind = layout & ~G_LAYOUT_STABLE;
+  assert((kind == G_LAYOUT_AOS || kind == G_LAYOUT_SOA ||
+          kind == G_LAYOUT_CHUNKED) &&
+         "Unknown storage layout!");
+
+  hash_vec type_hashes;
+  archetype_key(types, &type_hashes);
+  gid   arch_id = hash_vector(&type_hashes);
+  gsize value = layout;
+
+  /* Existing storage is never converted, the layout must be known upfront */
+  assert(!archetype_find(w, &type_hashes) &&
+         "Layout must be registered before the archetype exists!");
+
+  hash_to_size_del(&w->layout_registry, &arch_id);
+  hash_to_size_put(&w->layout_registry, &arch_id, &value);
+
+  end_frame(w->allocator);
+  log_leave;
+}
+
+#define ACCESS_DEFAULT 0
+#define ACCESS_READ    1
+#define ACCESS_WRITE   2
+
+#define TERM_REQUIRED 0 /* Matched on and accessed. */
+#define TERM_WITH     1 /* Matched on, never accessed. */
+#define TERM_WITHOUT  2 /* Archetypes holding it never match. */
+#define TERM_OPTIONAL 3 /* Accessed when the archetype holds it. */
+#define TERM_CHANGED  4 /* Required, written since the system last ran. */
+#define TERM_ADDED    5 /* Required, received since the system last ran. */
+
+/* A component of a system query and how the system uses it. */
+typedef struct query_term {
+  int8_t   access;
+  int8_t   presence;
+  uint64_t type; /* hash(comp name) */
+} query_term;
+
+static char *skip_spaces(char *c) {
+  while (*c == ' ') c++;
+  return c;
+}
+
+static char *skip_name(char *c) {
+  while (*c == '_' || isalnum((unsigned char)*c)) c++;
+  return c;
+}
+
+static bool is_word(char *name, char *end, char *word) {
+  return end - name == (int64_t)strlen(word) &&
+         !strncmp(name, word, end - name);
+}
+
+/* Apply the wrapper 'name' of a query term to 'term'. */
+static void apply_wrapper(query_term *term, char *name, char *end) {
+  if (is_word(name, end, "READ") || is_word(name, end, "WRITE")) {
+    assert(term->access == ACCESS_DEFAULT &&
+           "Query term declares its access twice!");
+    term->access = *name == 'R' ? ACCESS_READ : ACCESS_WRITE;
+    return;
+  }
+
+  assert(term->presence == TERM_REQUIRED &&
+         "Query term combines WITH, WITHOUT, OPTIONAL, CHANGED or ADDED!");
+  if (is_word(name, end, "WITH")) term->presence = TERM_WITH;
+  else if (is_word(name, end, "WITHOUT")) term->presence = TERM_WITHOUT;
+  else if (is_word(name, end, "OPTIONAL")) term->presence = TERM_OPTIONAL;
+  else if (is_word(name, end, "CHANGED")) term->presence = TERM_CHANGED;
+  else if (is_word(name, end, "ADDED")) term->presence = TERM_ADDED;
+  else
+    assert(false && "Unknown query term, use READ, WRITE, WITH, WITHOUT, "
+                    "OPTIONAL, CHANGED or ADDED!");
+}
+
+/* Split the query "A, READ(B), WITHOUT(C), OPTIONAL(READ(D)), CHANGED(E)"
+   into terms pushed onto the current frame and return how many there are. */
+static int64_t parse_terms(char *query, query_term **out) {
+  int64_t max_terms = 1;
+  for (char *c = query; *c; c++)
+    if (*c == ',') max_terms++;
+  query_term *terms = stpush(sizeof(query_term) * max_terms);
+  *out = terms;
+
+  int64_t count = 0;
+  char   *c = skip_spaces(query);
+  while (*c) {
+    query_term term = {.access = ACCESS_DEFAULT, .presence = TERM_REQUIRED};
+    int64_t    depth = 0;
+    char      *name = c;
+    char      *end = skip_name(c);
+    assert(end != name && "Expected a component name in the query!");
+
+    /* Every name followed by '(' wraps the rest of the term */
+    c = skip_spaces(end);
+    while (*c == '(') {
+      apply_wrapper(&term, name, end);
+      name = skip_spaces(c + 1);
+      end = skip_name(name);
+      assert(end != name && "Expected a component name in the query!");
+      c = skip_spaces(end);
+      depth++;
+    }
+    for (; depth > 0; depth--) {
+      assert(*c == ')' && "Query term is missing its ')'!");
+      c = skip_spaces(c + 1);
+    }
+    assert(!(term.access != ACCESS_DEFAULT &&
+             (term.presence == TERM_WITH || term.presence == TERM_WITHOUT)) &&
+           "WITH and WITHOUT components can not be accessed!");
+
+    term.type = hash_mem(name, end - name);
+    terms[count++] = term;
+
+    assert((*c == ',' || !*c) && "Query terms are separated by ','!");
+    if (*c == ',') c = skip_spaces(c + 1);
+  }
+  return count;
+}
 
-static feach(is_registered, uint64_t, hash, {
-  g_core *w = args;
-  assert(hash_to_size_get(&w->component_registry, &hash).value &&
-         "Error: attempted to register a system with unregistered component "
-         "types.");
-});
 void g_register_system(g_core *w, g_system sys, int32_t FLAGS, char *query) {
   log_enter;
   start_frame(w->allocator);
 
-  /* Collect the component id hashes */
-  hash_vec type_hashes;
-  archetype_key(query, &type_hashes);
-  hash_vec_foreach(&type_hashes, is_registered, w); /* Sanity check */
+  query_term *terms;
+  int64_t     count = parse_terms(query, &terms);
+
+  system_data data = {.start_system = sys};
+  g_signature excluded = {0};
+  type_set_hinit(&data.requirements);
+  for (int64_t i = 0; i < count; i++) {
+    query_term *term = &terms[i];
+    assert(hash_to_size_get(&w->component_registry, &term->type).value &&
+           "Error: attempted to register a system with unregistered "
+           "component types.");
+    assert(!(FLAGS == SYS_READONLY && term->access == ACCESS_WRITE) &&
+           "Read-only systems can not WRITE components!");
+
+    g_cid id = component_intern(term->type);
+    if (term->presence == TERM_WITHOUT) {
+      signature_set(&excluded, id);
+      continue;
+    }
+    if (term->presence != TERM_OPTIONAL) {
+      type_set_put(&data.requirements, &term->type);
+      signature_set(&data.signature, id);
+    }
+    if (term->presence == TERM_WITH) continue;
+    if (term->presence == TERM_CHANGED || term->presence == TERM_ADDED) {
+      signature_set(term->presence == TERM_CHANGED ? &data.changed
+                                                   : &data.added,
+                    id);
+      data.filtered = true;
+    }
+
+    /* A bare name is both read and written, read only in SYS_READONLY */
+    int8_t access = term->access;
+    if (access == ACCESS_DEFAULT)
+      access = FLAGS == SYS_READONLY ? ACCESS_READ : ACCESS_WRITE;
+    signature_set(access == ACCESS_READ ? &data.reads : &data.writes, id);
+  }
+  assert(!signature_intersects(&data.signature, &excluded) &&
+         "Query requires and excludes the same component!");
+
+  /* Archetypes created from now on pick the system up through its
+     matcher, the existing ones right away. */
+  data.id = w->system_registry.length;
+  system_vec_push(&w->system_registry, &data);
+  matcher_create(w, &data.signature, &excluded, data.id);
+
+  end_frame(w->allocator);
+  log_leave;
+}
 
-  type_set types;
-  type_set_hinit(&types);
-  hash_vec_foreach(&type_hashes, add_to_set, &types);
+matcher *g_create_view(g_core *w, char *query) {
+  log_enter;
+  start_frame(w->allocator);
+
+  query_term *terms;
+  int64_t     count = parse_terms(query, &terms);
+
+  /* Accesses only matter to the scheduler, a view just filters */
+  g_signature required = {0}, excluded = {0};
+  for (int64_t i = 0; i < count; i++) {
+    assert(hash_to_size_get(&w->component_registry, &terms[i].type).value &&
+           "Error: attempted to create a view with unregistered component "
+           "types.");
+    assert(terms[i].presence != TERM_CHANGED &&
+           terms[i].presence != TERM_ADDED &&
+           "Views do not support CHANGED or ADDED terms!");
+    g_cid id = component_intern(terms[i].type);
+    if (terms[i].presence == TERM_WITHOUT) signature_set(&excluded, id);
+    else if (terms[i].presence != TERM_OPTIONAL) signature_set(&required, id);
+  }
+  assert(!signature_intersects(&required, &excluded) &&
+         "Query requires and excludes the same component!");
 
-  system_vec_push(&w->system_registry, &(system_data){.requirements = types,
-                                                      .start_system = sys,
-                                                      .readonly = FLAGS});
+  matcher *view = matcher_create(w, &required, &excluded, -1);
 
   end_frame(w->allocator);
   log_leave;
+  return view;
 }
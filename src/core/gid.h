@@ -13,8 +13,23 @@
 #include "types.h"
 #include <stdatomic.h>
 
-#define SELECT_ID(id)   (uint32_t)((id & 0xFFFFFFFFFFFFFFFE) >> 1)
+/* Layout of a gid from the least significant bit up:
+     [0]      mode, STORAGE/CACHED for generators and ALV/DEL for entities
+     [1, 32]  index, the slot of the entity inside the entity index
+     [33, 63] generation, bumped every time the index is recycled */
+#define GID_GEN_SHIFT 33
+#define GID_GEN_MASK  0x7FFFFFFF
+
+#define SELECT_ID(id)   (uint32_t)((id & 0x00000001FFFFFFFE) >> 1)
 #define SELECT_MODE(id) (uint32_t)(id & 0x0000000000000001)
+#define SELECT_GEN(id)  (uint32_t)(((gid)(id) >> GID_GEN_SHIFT) & GID_GEN_MASK)
+
+#define GID_MAKE(index, gen, mode)                                             \
+  ((((gid)(gen) & GID_GEN_MASK) << GID_GEN_SHIFT) | ((gid)(index) << 1) |     \
+   (gid)(mode))
+
+/* The dead handle the next occupant of the index of 'id' will receive. */
+#define GID_NEXT_GEN(id) GID_MAKE(SELECT_ID(id), SELECT_GEN(id) + 1, DEL)
 
 #define STORAGE 0
 #define CACHED  1
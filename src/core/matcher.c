@@ -0,0 +1,150 @@
+#include "matcher.h"
+#include "archetype.h"
+#include "signature.h"
+
+/*-------------------------------------------------------
+ * Static Matcher Functions
+ *-------------------------------------------------------*/
+/* The matchers indexed under component 'id', created on first use. */
+static cache_vec *index_bucket(g_core *w, g_cid id) {
+  gid         key = id;
+  cache_vec **bucket = (cache_vec **)cache_map_get(&w->matcher_index, &key)
+                           .value;
+  if (bucket) return *bucket;
+
+  cache_vec *created = malloc(sizeof(cache_vec));
+  cache_vec_inita(created, w->allocator, TO_HEAP, 4);
+  cache_map_put(&w->matcher_index, &key, (void **)&created);
+  return created;
+}
+
+/* Index of the highest component in 'sig', -1 if it is empty. */
+static g_cid signature_last(g_signature *sig) {
+  for (int64_t i = G_SIGNATURE_WORDS - 1; i >= 0; i--)
+    if (sig->words[i]) return i * 64 + 63 - __builtin_clzll(sig->words[i]);
+  return -1;
+}
+
+/* Returns true if 'a' gained a contender. */
+static bool match(g_core *w, matcher *m, archetype *a) {
+  if (!signature_is_subset(&a->signature, &m->required) ||
+      signature_intersects(&a->signature, &m->excluded))
+    return false;
+  cache_vec_push(&m->matches, (void **)&a);
+  if (m->system == -1) return false;
+
+  system_vec_push(&a->contenders,
+                  system_vec_at(&w->system_registry, m->system));
+  return true;
+}
+
+static void unmatch(g_core *w, matcher *m, archetype *a) {
+  /* Matches stay in the order they matched */
+  for (int64_t i = 0; i < m->matches.length; i++) {
+    if (*cache_vec_at(&m->matches, i) != a) continue;
+    for (int64_t j = i + 1; j < m->matches.length; j++)
+      *cache_vec_at(&m->matches, j - 1) = *cache_vec_at(&m->matches, j);
+    cache_vec_pop(&m->matches);
+    return;
+  }
+}
+
+/* Call 'visit' with every matcher 'a' could satisfy. Those are the matchers
+   indexed under one of its components and the unindexed ones. */
+static void visit_candidates(g_core *w, archetype *a,
+                             void (*visit)(g_core *, matcher *, archetype *)) {
+  for (int64_t i = 0; i < w->matchers_unindexed.length; i++)
+    visit(w, *cache_vec_at(&w->matchers_unindexed, i), a);
+
+  for (int64_t i = 0; i < G_SIGNATURE_WORDS; i++) {
+    uint64_t word = a->signature.words[i];
+    while (word) {
+      gid         key = i * 64 + __builtin_ctzll(word);
+      cache_vec **bucket = (cache_vec **)cache_map_get(&w->matcher_index,
+                                                       &key)
+                               .value;
+      for (int64_t j = 0; bucket && j < (*bucket)->length; j++)
+        visit(w, *cache_vec_at(*bucket, j), a);
+      word &= word - 1;
+    }
+  }
+}
+
+static void visit_match(g_core *w, matcher *m, archetype *a) {
+  match(w, m, a);
+}
+
+feach(match_existing, kvpair, item, {
+  void   **list = args;
+  g_core  *w = list[0];
+  matcher   *m = list[1];
+  archetype *a = *(archetype **)item.value;
+  if (match(w, m, a)) archetype_schedule(a);
+});
+feach(free_bucket, kvpair, item, {
+  cache_vec *bucket = *(cache_vec **)item.value;
+  cache_vec_free(bucket);
+  free(bucket);
+});
+
+/*-------------------------------------------------------
+ * Matcher Operations
+ *-------------------------------------------------------*/
+void matchers_init(g_core *w) {
+  cache_vec_inita(&w->matchers, w->allocator, TO_HEAP, 16);
+  cache_vec_inita(&w->matchers_unindexed, w->allocator, TO_HEAP, 4);
+  cache_map_inita(&w->matcher_index, w->allocator, TO_HEAP, 16);
+}
+
+void matchers_free(g_core *w) {
+  for (int64_t i = 0; i < w->matchers.length; i++) {
+    matcher *m = *cache_vec_at(&w->matchers, i);
+    cache_vec_free(&m->matches);
+    free(m);
+  }
+  cache_vec_free(&w->matchers);
+  cache_vec_free(&w->matchers_unindexed);
+  cache_map_foreach(&w->matcher_index, free_bucket, NULL);
+  cache_map_free(&w->matcher_index);
+}
+
+matcher *matcher_create(g_core *w, g_signature *required,
+                        g_signature *excluded, int64_t system) {
+  log_enter;
+  matcher *m = calloc(1, sizeof(*m));
+  m->world = w;
+  m->required = *required;
+  m->excluded = *excluded;
+  m->system = system;
+  cache_vec_inita(&m->matches, w->allocator, TO_HEAP, 16);
+  cache_vec_push(&w->matchers, (void **)&m);
+
+  /* One bucket is enough, an archetype only matches if it has every
+     required component, so also the one indexed. */
+  g_cid key = signature_last(required);
+  if (key == -1) cache_vec_push(&w->matchers_unindexed, (void **)&m);
+  else cache_vec_push(index_bucket(w, key), (void **)&m);
+
+  void *args[2];
+  args[0] = w;
+  args[1] = m;
+  hash_to_archetype_foreach(&w->archetype_registry, match_existing, args);
+
+  log_leave;
+  return m;
+}
+
+void matchers_add_archetype(g_core *w, archetype *a) {
+  log_enter;
+  visit_candidates(w, a, visit_match);
+  archetype_schedule(a);
+  log_leave;
+}
+
+void matchers_remove_archetype(g_core *w, archetype *a) {
+  log_enter;
+  visit_candidates(w, a, unmatch);
+  system_vec_clear(&a->contenders);
+  archetype_schedule(a);
+  log_leave;
+}
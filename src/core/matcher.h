@@ -0,0 +1,37 @@
+/* =========================================================================
+    Author: E.D Choparinov, Amsterdam
+    Related Files: matcher.h matcher.c
+    Purpose:
+        The purpose of this file is to keep the archetypes matching a query
+        up to date without rescanning. A matcher remembers its matches and
+        is indexed under one component it requires. When an archetype is
+        created only the matchers indexed under one of its components are
+        tested, and a new matcher only tests the archetypes that exist.
+========================================================================= */
+#ifndef __HEADER_MATCHER_H__
+#define __HEADER_MATCHER_H__
+
+#include "gecs.h"
+
+/* Initialize the matcher bookkeeping of 'w'. */
+void matchers_init(g_core *w);
+
+/* Free every matcher of 'w'. */
+void matchers_free(g_core *w);
+
+/* Create a matcher of 'w' for archetypes holding every component in
+   'required' and none in 'excluded' and match it against the existing
+   archetypes. When 'system' is not -1 every match gets the system at that
+   index of `system_registry` as a contender. Not thread safe. */
+matcher *matcher_create(g_core *w, g_signature *required,
+                        g_signature *excluded, int64_t system);
+
+/* Add the new archetype 'a' to every matcher of 'w' it satisfies. Not
+   thread safe. */
+void matchers_add_archetype(g_core *w, archetype *a);
+
+/* Take 'a' out of every matcher of 'w' and drop its contenders. Not thread
+   safe. */
+void matchers_remove_archetype(g_core *w, archetype *a);
+
+#endif
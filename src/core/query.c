@@ -1,5 +1,27 @@
 #include "archetype.h"
+#include "command.h"
 #include "gecs.h"
+#include "scheduler.h"
+
+/* The end of the chunk holding 'row'. Fragments that are not chunked are a
+   single chunk. */
+static int64_t chunk_end(archetype *a, int64_t row) {
+  if (a->layout != G_LAYOUT_CHUNKED) return a->length;
+  int64_t end = ((row >> a->chunk_shift) + 1) << a->chunk_shift;
+  return end < a->length ? end : a->length;
+}
+
+/* The first row from 'row' on inside a chunk passing the CHANGED and ADDED
+   terms of the system processing 'vec'. */
+static int64_t next_passing(g_par *vec, int64_t row) {
+  archetype   *a = vec->arch;
+  system_data *sys = vec->system;
+  if (!sys || !sys->filtered) return row;
+  while (row < a->length &&
+         !archetype_block_passes(a, archetype_block(a, row), sys))
+    row = chunk_end(a, row);
+  return row;
+}
 
 /*-------------------------------------------------------
  * Sequential Query Operations
@@ -8,33 +30,50 @@ g_pool gq_seq(g_query *q) {
   g_pool pool = {0};
 
   pool.entities = gq_vectorize(q);
-  pool.idx = 0;
+  pool.idx = next_passing(&pool.entities, 0);
 
   return pool;
 }
 
 g_pool gq_next(g_pool itr) {
-  assert(itr.idx < itr.entities.stored_components->length);
+  archetype *a = itr.entities.arch;
+  assert(itr.idx < a->length);
   itr.idx++;
+
+  /* Chunks failing the filters of the system are skipped whole */
+  if (itr.idx < a->length &&
+      archetype_block(a, itr.idx) != archetype_block(a, itr.idx - 1))
+    itr.idx = next_passing(&itr.entities, itr.idx);
   return itr;
 }
 
 bool gq_done(g_pool itr) {
-  return itr.idx == itr.entities.stored_components->length;
+  return itr.idx == itr.entities.arch->length;
 }
 
+int64_t gq_length(g_pool itr) { return itr.entities.arch->length; }
+
 void *__gq_field(g_pool *itr, char *type) {
   log_enter;
-  gid    type_id = (gid)hash_bytes(type, strlen(type));
-  gsize *offset =
-      hash_to_size_get(itr->entities.component_offsets, &type_id).value;
+  archetype *arch = itr->entities.arch;
+  int64_t    col = archetype_column(arch, (gid)hash_mem(type, strlen(type)));
 
-  assert(offset && "Entity does not have this component");
+  assert(col != -1 && "Entity does not have this component");
 
-  cbuff buff;
-  buff_init(&buff, vec_at(itr->entities.stored_components, itr->idx));
   log_leave;
-  return buff_skip(&buff, *offset);
+  return archetype_field(arch, itr->idx, col);
+}
+
+void *__gq_sfield(g_pool *itr, g_cid id) {
+  archetype *arch = itr->entities.arch;
+  assert(id >= 0 && "Component was not declared with G_DECLARE");
+
+  int64_t col = id < arch->cid_lookup.length
+                    ? *int64_vec_at(&arch->cid_lookup, id)
+                    : -1;
+  assert(col != -1 && "Entity does not have this component");
+
+  return archetype_field(arch, itr->idx, col);
 }
 
 g_pool g_get_pool(g_core *w, char *query) {
@@ -45,14 +84,11 @@ g_pool g_get_pool(g_core *w, char *query) {
 
   hash_vec type_hashes;
   archetype_key(query, &type_hashes);
-  gid arch_id = hash_vector(&type_hashes);
-
-  archetype *arch = id_to_archetype_get(&w->archetype_registry, &arch_id).value;
+  archetype *arch = archetype_find(w, &type_hashes);
+  if (!arch) arch = archetype_revive(w, &type_hashes);
 
   assert(arch && "Archetype does not exist!");
 
-  pool.entities.component_offsets = &arch->offsets;
-  pool.entities.stored_components = &arch->components;
   pool.entities.arch = arch;
   pool.entities.tick = w->tick;
   pool.idx = 0;
@@ -67,66 +103,261 @@ g_pool g_get_pool(g_core *w, char *query) {
  *-------------------------------------------------------*/
 g_par gq_vectorize(g_query *q) {
   g_par itr = {0};
-  itr.component_offsets = &q->archetype_ctx->offsets;
-  itr.stored_components = &q->archetype_ctx->components;
   itr.arch = q->archetype_ctx;
   itr.tick = q->world_ctx->tick;
   itr.world = q->world_ctx;
+  itr.system = q->system_ctx;
   return itr;
 }
 
+int64_t gq_par_length(g_par vec) { return vec.arch->length; }
+
+void *__gq_column(g_par *vec, char *type) {
+  archetype *arch = vec->arch;
+  int64_t    col = archetype_column(arch, (gid)hash_mem(type, strlen(type)));
+
+  assert(col != -1 && "Entity does not have this component");
+
+  if (arch->layout != G_LAYOUT_SOA) return NULL;
+  return column_vec_at(&arch->columns, col)->data;
+}
+
+/* The column of component 'id' in 'arch', -1 if it does not have it. */
+static int64_t column_of(archetype *arch, g_cid id) {
+  if (id < 0 || id >= arch->cid_lookup.length) return -1;
+  return *int64_vec_at(&arch->cid_lookup, id);
+}
+
+static g_field field_of(archetype *arch, int64_t col) {
+  column *c = column_vec_at(&arch->columns, col);
+  g_field f = {.stride = c->size};
+  switch (arch->layout) {
+  case G_LAYOUT_AOS:
+    f.base = (char *)arch->components.elements + c->offset;
+    f.stride = arch->components.__el_size;
+    break;
+  case G_LAYOUT_SOA: f.base = c->data; break;
+  case G_LAYOUT_CHUNKED:
+    f.chunked = true;
+    f.chunks = (char **)arch->chunks.elements;
+    f.offset = c->chunk_offset;
+    f.shift = arch->chunk_shift;
+    break;
+  }
+  return f;
+}
+
+g_field gq_handle(g_par vec, g_cid id) {
+  int64_t col = column_of(vec.arch, id);
+  assert(col != -1 && "Entity does not have this component");
+  return field_of(vec.arch, col);
+}
+
+g_field gq_optional(g_par vec, g_cid id) {
+  int64_t col = column_of(vec.arch, id);
+  if (col == -1) return (g_field){0};
+  return field_of(vec.arch, col);
+}
+
+int64_t gq_chunk_count(g_par vec) {
+  archetype *arch = vec.arch;
+  if (arch->layout == G_LAYOUT_CHUNKED) return arch->chunks.length;
+  if (arch->layout == G_LAYOUT_SOA) return arch->length > 0;
+  return 0;
+}
+
+bool gq_chunk_changed(g_par vec, int64_t chunk_idx) {
+  assert(chunk_idx < gq_chunk_count(vec) && "Chunk does not exist");
+  return !vec.system || !vec.system->filtered ||
+         archetype_block_passes(vec.arch, chunk_idx, vec.system);
+}
+
+int64_t gq_chunk_length(g_par vec, int64_t chunk_idx) {
+  archetype *arch = vec.arch;
+  assert(chunk_idx < gq_chunk_count(vec) && "Chunk does not exist");
+
+  if (arch->layout == G_LAYOUT_SOA) return arch->length;
+
+  int64_t rows = (int64_t)1 << arch->chunk_shift;
+  int64_t start_at = chunk_idx * rows;
+  return arch->length - start_at < rows ? arch->length - start_at : rows;
+}
+
+void *__gq_chunk_column(g_par *vec, char *type, int64_t chunk_idx) {
+  archetype *arch = vec->arch;
+  int64_t    col = archetype_column(arch, (gid)hash_mem(type, strlen(type)));
+
+  assert(col != -1 && "Entity does not have this component");
+  assert(chunk_idx < gq_chunk_count(*vec) && "Chunk does not exist");
+
+  if (arch->layout == G_LAYOUT_SOA)
+    return column_vec_at(&arch->columns, col)->data;
+  return archetype_field(arch, chunk_idx << arch->chunk_shift, col);
+}
+
 typedef struct __gq_each_args __gq_each_args;
 struct __gq_each_args {
-  int64_t start_at, stop_at;
-  g_par   entities;
-  void   *args;
-  _each   func;
+  g_par entities;
+  void *args;
+  _each func;
 };
-void *__gq_each_thread(void *args) {
-  __gq_each_args *input = (__gq_each_args *)args;
-  for (int64_t i = input->start_at; i < input->stop_at; i++) {
-    input->func(&(g_pool){.idx = i, .entities = input->entities}, input->args);
+static void __gq_each_range(__gq_each_args *input, int64_t start_at,
+                            int64_t stop_at) {
+  archetype *a = input->entities.arch;
+  for (int64_t i = start_at; i < stop_at;) {
+    i = next_passing(&input->entities, i);
+    int64_t end = chunk_end(a, i) < stop_at ? chunk_end(a, i) : stop_at;
+    for (; i < end; i++)
+      input->func(&(g_pool){.idx = i, .entities = input->entities},
+                  input->args);
   }
-
-  return NULL;
+}
+static void __gq_each_chunk(task *t) {
+  __gq_each_range(t->ctx[0], t->start_at, t->stop_at);
 }
 void __gq_each(g_par vec, _each func, void *args) {
-  if (vec.stored_components->length == 0) return;
+  int64_t length = vec.arch->length;
+  if (length == 0) return;
 
-  /* Split over 8 threads */
-  pthread_t      threads[8];
-  __gq_each_args thread_args[8];
-  int64_t        step = vec.stored_components->length / 8;
+  __gq_each_args input = {.entities = vec, .args = args, .func = func};
 
-  /* For items that are < 8, we spint up a thread for each */
-  if (step == 0) step = 1;
+  /* Small fragments are cheaper to process than to schedule. */
+  g_core    *w = vec.world;
+  scheduler *workers = w->workers;
+  if (w->disable_concurrency == 1 || !workers || workers->thread_count == 1 ||
+      length < w->each_serial_threshold) {
+    __gq_each_range(&input, 0, length);
+    return;
+  }
+
+  /* Split the fragment into more chunks than there are threads. Chunks land
+     on this threads deque, idle threads steal them so one large archetype
+     does not become a straggler. */
+  int64_t step = length / (workers->thread_count * EACH_CHUNKS_PER_THREAD);
+  if (step < w->each_grain_size) step = w->each_grain_size;
+  if (step < 1) step = 1;
+
+  /* Chunked fragments are split on chunk boundaries so no two tasks share
+     a chunk. */
+  if (vec.arch->layout == G_LAYOUT_CHUNKED) {
+    int64_t rows = (int64_t)1 << vec.arch->chunk_shift;
+    step = (step + rows - 1) / rows * rows;
+  }
 
-  int64_t thread_id = 0;
-  int64_t start_idx = 0;
+  /* Commands the chunks record apply between those recorded before and
+     after them */
+  command_fence(w);
+  task_group group;
+  task_group_init(&group);
 
-  for (int64_t i = 0; i < 8 && start_idx < vec.stored_components->length; i++) {
+  for (int64_t start_idx = 0; start_idx < length; start_idx += step) {
     int64_t stop_idx = start_idx + step;
-    if (i == 7 || stop_idx >= vec.stored_components->length) {
-      stop_idx = vec.stored_components->length;
+    if (stop_idx > length) stop_idx = length;
+
+    scheduler_submit(workers, &(task){.run = __gq_each_chunk,
+                                      .group = &group,
+                                      .ctx = {&input},
+                                      .start_at = start_idx,
+                                      .stop_at = stop_idx});
+  }
+
+  scheduler_wait(workers, &group);
+  command_fence(w);
+}
+
+/*-------------------------------------------------------
+ * View Operations
+ *-------------------------------------------------------*/
+g_view_itr g_view_iter(matcher *view) {
+  return (g_view_itr){.view = view};
+}
+
+bool g_view_next(g_view_itr *itr) {
+  archetype *a = itr->entities.arch;
+  if (a && itr->stop_at < a->length) {
+    itr->start_at = itr->stop_at;
+    itr->stop_at = chunk_end(a, itr->start_at);
+    return true;
+  }
+
+  g_core *w = itr->view->world;
+  while (itr->match < itr->view->matches.length) {
+    a = *cache_vec_at(&itr->view->matches, itr->match++);
+    if (!a->length) continue;
+
+    itr->entities = (g_par){.arch = a, .world = w, .tick = w->tick};
+    itr->start_at = 0;
+    itr->stop_at = chunk_end(a, 0);
+    return true;
+  }
+  return false;
+}
+
+typedef struct view_each_args view_each_args;
+struct view_each_args {
+  g_core *world;
+  g_range func;
+  void   *args;
+};
+static void view_each_range(task *t) {
+  view_each_args *input = t->ctx[0];
+  g_core         *w = input->world;
+  g_par           vec = {.arch = t->ctx[1], .world = w, .tick = w->tick};
+  input->func(vec, t->start_at, t->stop_at, input->args);
+}
+void g_view_each(matcher *view, g_range func, void *args) {
+  g_core *w = view->world;
+  int64_t total = 0;
+  for (int64_t i = 0; i < view->matches.length; i++)
+    total += ((archetype *)*cache_vec_at(&view->matches, i))->length;
+
+  /* Views are read between ticks, the pool may not exist yet */
+  if (total == 0) return;
+  if (!w->disable_concurrency && !w->workers) {
+    w->workers = scheduler_create(w->thread_count);
+    command_buffers_reserve(w, w->workers->thread_count);
+  }
+
+  scheduler *workers = w->workers;
+  if (w->disable_concurrency == 1 || !workers || workers->thread_count == 1 ||
+      total < w->each_serial_threshold) {
+    g_view_itr itr = g_view_iter(view);
+    while (g_view_next(&itr))
+      func(itr.entities, itr.start_at, itr.stop_at, args);
+    return;
+  }
+
+  /* One split for the whole view so small fragments are not each turned
+     into a task */
+  int64_t step = total / (workers->thread_count * EACH_CHUNKS_PER_THREAD);
+  if (step < w->each_grain_size) step = w->each_grain_size;
+  if (step < 1) step = 1;
+
+  view_each_args input = {.world = w, .func = func, .args = args};
+  task_group     group;
+  task_group_init(&group);
+  command_fence(w);
+
+  for (int64_t i = 0; i < view->matches.length; i++) {
+    archetype *a = *cache_vec_at(&view->matches, i);
+    int64_t    a_step = step;
+    if (a->layout == G_LAYOUT_CHUNKED) {
+      int64_t rows = (int64_t)1 << a->chunk_shift;
+      a_step = (step + rows - 1) / rows * rows;
     }
 
-    thread_args[thread_id] = (__gq_each_args){.start_at = start_idx,
-                                              .stop_at = stop_idx,
-                                              .entities = vec,
-                                              .args = args,
-                                              .func = func};
-    if (vec.world->disable_concurrency == 1) {
-      __gq_each_thread(&thread_args[thread_id]);
-    } else {
-      pthread_create(&threads[thread_id], NULL, __gq_each_thread,
-                     &thread_args[thread_id]);
-      thread_id++;
+    for (int64_t start_idx = 0; start_idx < a->length; start_idx += a_step) {
+      int64_t stop_idx = start_idx + a_step;
+      if (stop_idx > a->length) stop_idx = a->length;
+
+      scheduler_submit(workers, &(task){.run = view_each_range,
+                                        .group = &group,
+                                        .ctx = {&input, a},
+                                        .start_at = start_idx,
+                                        .stop_at = stop_idx});
     }
-    start_idx = stop_idx;
   }
 
-  if (vec.world->disable_concurrency == 1) return;
-  for (int64_t i = 0; i < thread_id; i++) {
-    pthread_join(threads[i], NULL);
-  }
+  scheduler_wait(workers, &group);
+  command_fence(w);
 }
@@ -0,0 +1,241 @@
+#include "scheduler.h"
+#include "logger.h"
+#include <unistd.h>
+
+VEC_TYPE_IMPL(task_vec, task);
+
+/* Each thread remembers which scheduler it works for and which deque it owns.
+   Threads foreign to a scheduler use deque 0. */
+static _Thread_local scheduler *local_scheduler = NULL;
+static _Thread_local int64_t    local_index = 0;
+static _Thread_local uint64_t   local_seed = 0;
+
+typedef struct worker_args worker_args;
+struct worker_args {
+  scheduler *s;
+  int64_t    index;
+};
+
+/*-------------------------------------------------------
+ * Static Deque Functions
+ *-------------------------------------------------------*/
+static void deque_push(worker_deque *d, task *t) {
+  pthread_mutex_lock(&d->lock);
+  task_vec_push(&d->tasks, t);
+  pthread_mutex_unlock(&d->lock);
+}
+
+/* Take the newest task, used by the owner for cache locality. */
+static bool deque_pop(worker_deque *d, task *out) {
+  bool found = false;
+  pthread_mutex_lock(&d->lock);
+  if (d->tasks.length > d->head) {
+    *out = *task_vec_top(&d->tasks);
+    task_vec_pop(&d->tasks);
+    found = true;
+  }
+  if (d->tasks.length == d->head) {
+    task_vec_clear(&d->tasks);
+    d->head = 0;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+/* Take the oldest task, used by thieves. Old tasks tend to be the largest
+   because they were split off first. */
+static bool deque_steal(worker_deque *d, task *out) {
+  bool found = false;
+  if (pthread_mutex_trylock(&d->lock)) return false;
+  if (d->tasks.length > d->head) {
+    *out = *task_vec_at(&d->tasks, d->head);
+    d->head++;
+    found = true;
+  }
+  if (d->tasks.length == d->head) {
+    task_vec_clear(&d->tasks);
+    d->head = 0;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+/*-------------------------------------------------------
+ * Static Scheduler Functions
+ *-------------------------------------------------------*/
+static int64_t self_index(scheduler *s) {
+  return local_scheduler == s ? local_index : 0;
+}
+
+/* xorshift64, good enough for picking victims. */
+static uint64_t next_random(void) {
+  if (local_seed == 0) local_seed = (uint64_t)(uintptr_t)&local_seed | 1;
+  local_seed ^= local_seed << 13;
+  local_seed ^= local_seed >> 7;
+  local_seed ^= local_seed << 17;
+  return local_seed;
+}
+
+static bool find_task(scheduler *s, task *out) {
+  int64_t self = self_index(s);
+  bool    found = deque_pop(&s->deques[self], out);
+
+  /* Visit every other deque once, starting at a random victim */
+  int64_t start = next_random() % s->thread_count;
+  for (int64_t i = 0; !found && i < s->thread_count; i++) {
+    int64_t victim = (start + i) % s->thread_count;
+    if (victim == self) continue;
+    found = deque_steal(&s->deques[victim], out);
+  }
+
+  if (found) atomic_fetch_sub(&s->queued, 1);
+  return found;
+}
+
+static void wake_sleepers(scheduler *s, bool all) {
+  if (atomic_load(&s->sleepers) == 0) return;
+  pthread_mutex_lock(&s->lock);
+  if (all) pthread_cond_broadcast(&s->wake);
+  else pthread_cond_signal(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void run_task(scheduler *s, task *t) {
+  /* Tasks are free to start frames on any allocator. The frame context is
+     per thread, so we restore it to keep the callers frames intact. */
+  stalloc *prev_ctx = get_frame_ctx();
+  t->run(t);
+  set_frame_ctx(prev_ctx);
+
+  /* The last task of a group wakes everyone that may be waiting on it. */
+  if (atomic_fetch_sub(&t->group->pending, 1) == 1) wake_sleepers(s, true);
+}
+
+/* Sleep until there is work queued, `g` drained (if given) or shutdown. */
+static void sleep_until_work(scheduler *s, task_group *g) {
+  pthread_mutex_lock(&s->lock);
+  atomic_fetch_add(&s->sleepers, 1);
+  while (atomic_load(&s->queued) == 0 && !atomic_load(&s->shutdown) &&
+         (!g || atomic_load(&g->pending) > 0)) {
+    pthread_cond_wait(&s->wake, &s->lock);
+  }
+  atomic_fetch_sub(&s->sleepers, 1);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void *worker_entry(void *args) {
+  worker_args *input = args;
+  scheduler   *s = input->s;
+  task         t;
+
+  local_scheduler = s;
+  local_index = input->index;
+  local_seed = (uint64_t)(input->index + 1) * 0x9E3779B97F4A7C15ull;
+  free(input);
+
+  while (!atomic_load(&s->shutdown)) {
+    if (find_task(s, &t)) run_task(s, &t);
+    else sleep_until_work(s, NULL);
+  }
+
+  return NULL;
+}
+
+/*-------------------------------------------------------
+ * Container Operations
+ *-------------------------------------------------------*/
+scheduler *scheduler_create(int64_t thread_count) {
+  log_enter;
+  assert(thread_count > 0 && "Scheduler requires at least one thread!");
+
+  scheduler *s = calloc(1, sizeof(*s));
+  s->thread_count = thread_count;
+  s->allocator = stalloc_create(STALLOC_DEFAULT);
+
+  atomic_init(&s->queued, 0);
+  atomic_init(&s->sleepers, 0);
+  atomic_init(&s->shutdown, false);
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->wake, NULL);
+
+  s->deques = calloc(thread_count, sizeof(worker_deque));
+  for (int64_t i = 0; i < thread_count; i++) {
+    pthread_mutex_init(&s->deques[i].lock, NULL);
+    task_vec_inita(&s->deques[i].tasks, s->allocator, TO_HEAP, 64);
+    s->deques[i].head = 0;
+  }
+
+  s->threads = calloc(thread_count, sizeof(pthread_t));
+  for (int64_t i = 0; i < thread_count - 1; i++) {
+    worker_args *args = malloc(sizeof(*args));
+    *args = (worker_args){.s = s, .index = i + 1};
+    if (pthread_create(&s->threads[i], NULL, worker_entry, args)) {
+      log_error("Unable to create worker thread");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  log_leave;
+  return s;
+}
+
+void scheduler_free(scheduler *s) {
+  log_enter;
+
+  pthread_mutex_lock(&s->lock);
+  atomic_store(&s->shutdown, true);
+  pthread_cond_broadcast(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+
+  for (int64_t i = 0; i < s->thread_count - 1; i++) {
+    if (pthread_join(s->threads[i], NULL)) {
+      log_error("Worker thread unable to be joined");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (int64_t i = 0; i < s->thread_count; i++) {
+    pthread_mutex_destroy(&s->deques[i].lock);
+    task_vec_free(&s->deques[i].tasks);
+  }
+
+  pthread_cond_destroy(&s->wake);
+  pthread_mutex_destroy(&s->lock);
+
+  stalloc_free(s->allocator);
+  free(s->deques);
+  free(s->threads);
+  free(s);
+
+  log_leave;
+}
+
+/*-------------------------------------------------------
+ * Task Operations
+ *-------------------------------------------------------*/
+void task_group_init(task_group *g) { atomic_init(&g->pending, 0); }
+
+void scheduler_submit(scheduler *s, task *t) {
+  atomic_fetch_add(&t->group->pending, 1);
+  deque_push(&s->deques[self_index(s)], t);
+  atomic_fetch_add(&s->queued, 1);
+  wake_sleepers(s, false);
+}
+
+void scheduler_wait(scheduler *s, task_group *g) {
+  task t;
+
+  /* Help out instead of idling, this is also what allows tasks to wait on
+     nested groups without deadlocking a fixed size pool. */
+  while (atomic_load(&g->pending) > 0) {
+    if (find_task(s, &t)) run_task(s, &t);
+    else sleep_until_work(s, g);
+  }
+}
+
+int64_t scheduler_thread_index(scheduler *s) { return self_index(s); }
+
+int64_t scheduler_core_count(void) {
+  int64_t cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? cores : 1;
+}
@@ -0,0 +1,95 @@
+/* =========================================================================
+    Author: E.D Choparinov, Amsterdam
+    Related Files: scheduler.h scheduler.c
+    Purpose:
+        The purpose of this file is to house the work stealing scheduler
+        GECS uses to execute archetype jobs and vectorized chunks. The
+        scheduler is created once per world with a fixed amount of threads.
+        Each thread owns a deque it pushes and pops work on, idle threads
+        steal from the opposite end of a random victims deque. Threads that
+        find no work anywhere block on a condition variable instead of
+        spinning so a world between ticks costs nothing.
+========================================================================= */
+#ifndef __HEADER_SCHEDULER_H__
+#define __HEADER_SCHEDULER_H__
+
+#include "types.h"
+
+typedef struct task         task;
+typedef struct task_group   task_group;
+typedef struct worker_deque worker_deque;
+
+/* Type representing the function a worker calls to execute a task. */
+typedef void (*task_fn)(task *t);
+
+/* A task is a small unit of work copied by value into a deque. The context
+   slots and range are free to be used by whatever submitted the task. */
+struct task {
+  task_fn     run;
+  task_group *group; /* Group notified when this task completes. */
+  void       *ctx[3];
+  int64_t     start_at, stop_at;
+};
+
+/* A task group tracks how many submitted tasks have not finished yet. Waiting
+   on a group blocks until all of its tasks completed. */
+struct task_group {
+  atomic_int_least64_t pending;
+};
+
+VEC_TYPEDEC(task_vec, task);
+
+/* The owner pushes and pops at the back of `tasks`, thieves take from
+   `head`. Once both ends meet the deque is reset so it does not grow. */
+struct worker_deque {
+  pthread_mutex_t lock;
+  task_vec        tasks; /* Vec : task */
+  int64_t         head;  /* Index of the oldest task, the steal end. */
+};
+
+struct scheduler {
+  pthread_t *threads;      /* Worker threads, excluding the caller thread. */
+  int64_t    thread_count; /* Total threads working, including the caller. */
+
+  /* One deque per thread. Index 0 belongs to threads that are not workers
+     of this scheduler (the thread calling `g_progress`). */
+  worker_deque *deques;
+  stalloc      *allocator; /* Allocations for the deques are done here. */
+
+  /* Threads that found no work sleep here. `queued` counts tasks sitting in
+     any deque and `sleepers` lets producers skip the lock when nobody
+     sleeps. */
+  atomic_int_least64_t queued, sleepers;
+  pthread_mutex_t      lock;
+  pthread_cond_t       wake; /* Signalled on new work or when a group drains. */
+  atomic_bool          shutdown;
+};
+
+/* Allocate a new scheduler using `thread_count` threads in total. The thread
+   calling `scheduler_wait` counts as one of them, so `thread_count - 1`
+   workers are spawned. Destroy with `scheduler_free`. */
+scheduler *scheduler_create(int64_t thread_count);
+
+/* Stop and join all workers and free the scheduler `s`. */
+void scheduler_free(scheduler *s);
+
+/* Initialize a task group `g` with no pending tasks. */
+void task_group_init(task_group *g);
+
+/* Push task `t` onto the calling threads deque. The task is registered on
+   `t->group`. */
+void scheduler_submit(scheduler *s, task *t);
+
+/* Block until every task in group `g` finished. The calling thread executes
+   its own and stolen tasks while it waits so nested waits never starve the
+   pool. */
+void scheduler_wait(scheduler *s, task_group *g);
+
+/* Index of the calling thread inside `s`, in [0, thread_count). Threads that
+   are not workers of `s` share index 0. */
+int64_t scheduler_thread_index(scheduler *s);
+
+/* Query the amount of online processors of the machine. */
+int64_t scheduler_core_count(void);
+
+#endif
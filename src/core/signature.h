@@ -0,0 +1,93 @@
+/* =========================================================================
+    Author: E.D Choparinov, Amsterdam
+    Related Files: signature.h types.h
+    Purpose:
+        The purpose of this file is to implement the fixed width bitset
+        signatures archetypes and systems use for matching. Bit `n` is set
+        when the component with dense id `n` is part of the set. Testing
+        subsets and intersections becomes a few AND/compare instructions
+        instead of walking hash sets. SSE2 and AVX2 are used when the
+        compiler targets them.
+========================================================================= */
+#ifndef __HEADER_SIGNATURE_H__
+#define __HEADER_SIGNATURE_H__
+
+#include "gecs.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Add the component with dense id 'id' to 'sig'. */
+static inline void signature_set(g_signature *sig, g_cid id) {
+  assert(id >= 0 && id < G_MAX_COMPONENTS && "Component id out of range!");
+  sig->words[id >> 6] |= (uint64_t)1 << (id & 63);
+}
+
+/* Check if the component with dense id 'id' is in 'sig'. */
+static inline bool signature_has(g_signature *sig, g_cid id) {
+  return (sig->words[id >> 6] >> (id & 63)) & 1;
+}
+
+/* Check if every component of 'sub' is also in 'sig'. */
+static inline bool signature_is_subset(g_signature *sig, g_signature *sub) {
+#if defined(__AVX2__)
+  for (int64_t i = 0; i < G_SIGNATURE_WORDS; i += 4) {
+    __m256i a = _mm256_loadu_si256((__m256i *)&sig->words[i]);
+    __m256i b = _mm256_loadu_si256((__m256i *)&sub->words[i]);
+    if (!_mm256_testc_si256(a, b)) return false;
+  }
+  return true;
+#elif defined(__SSE2__)
+  for (int64_t i = 0; i < G_SIGNATURE_WORDS; i += 2) {
+    __m128i a = _mm_loadu_si128((__m128i *)&sig->words[i]);
+    __m128i b = _mm_loadu_si128((__m128i *)&sub->words[i]);
+    __m128i c = _mm_cmpeq_epi8(_mm_and_si128(a, b), b);
+    if (_mm_movemask_epi8(c) != 0xFFFF) return false;
+  }
+  return true;
+#else
+  for (int64_t i = 0; i < G_SIGNATURE_WORDS; i++)
+    if ((sig->words[i] & sub->words[i]) != sub->words[i]) return false;
+  return true;
+#endif
+}
+
+/* Check if 'a' and 'b' share at least one component. */
+static inline bool signature_intersects(g_signature *a, g_signature *b) {
+  uint64_t any = 0;
+  for (int64_t i = 0; i < G_SIGNATURE_WORDS; i++)
+    any |= a->words[i] & b->words[i];
+  return any != 0;
+}
+
+/* Check if 'a' and 'b' contain exactly the same components. */
+static inline bool signature_equals(g_signature *a, g_signature *b) {
+  uint64_t diff = 0;
+  for (int64_t i = 0; i < G_SIGNATURE_WORDS; i++)
+    diff |= a->words[i] ^ b->words[i];
+  return diff == 0;
+}
+
+/* Store the components either 'a' or 'b' contains in 'out'. */
+static inline void signature_or(g_signature *a, g_signature *b,
+                                g_signature *out) {
+  for (int64_t i = 0; i < G_SIGNATURE_WORDS; i++)
+    out->words[i] = a->words[i] | b->words[i];
+}
+
+/* Store the components of 'a' that 'b' does not contain in 'out'. */
+static inline void signature_andnot(g_signature *a, g_signature *b,
+                                    g_signature *out) {
+  for (int64_t i = 0; i < G_SIGNATURE_WORDS; i++)
+    out->words[i] = a->words[i] & ~b->words[i];
+}
+
+/* Store the components both 'a' and 'b' contain in 'out'. */
+static inline void signature_and(g_signature *a, g_signature *b,
+                                 g_signature *out) {
+  for (int64_t i = 0; i < G_SIGNATURE_WORDS; i++)
+    out->words[i] = a->words[i] & b->words[i];
+}
+
+#endif
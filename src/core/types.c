@@ -1,20 +1,26 @@
 #include "types.h"
 
 VEC_TYPE_IMPL(composite, void *);
+VEC_TYPE_IMPL(column_vec, column);
+VEC_TYPE_IMPL(chunk_vec, void *);
+VEC_TYPE_IMPL(copy_plan, copy_run);
+VEC_TYPE_IMPL(command_vec, command *);
 
 VEC_TYPE_IMPL(id_vec, gid);
 VEC_TYPE_IMPL(int64_vec, int64_t);
+VEC_TYPE_IMPL(size_vec, gsize);
 VEC_TYPE_IMPL(system_vec, system_data);
 
 MAP_TYPE_IMPL(id_to_size, gid, gsize);
 MAP_TYPE_IMPL(id_to_id, gid, gid);
 MAP_TYPE_IMPL(id_to_int64, gid, int64_t);
-MAP_TYPE_IMPL(id_to_archetype, gid, archetype);
+MAP_TYPE_IMPL(id_to_archetype, gid, archetype *);
 
 MAP_TYPE_IMPL(id_to_hash, gid, uint64_t);
 MAP_TYPE_IMPL(hash_to_size, uint64_t, gsize);
 VEC_TYPE_IMPL(hash_vec, uint64_t);
-MAP_TYPE_IMPL(hash_to_archetype, uint64_t, archetype);
+MAP_TYPE_IMPL(hash_to_archetype, uint64_t, archetype *);
+MAP_TYPE_IMPL(hash_to_edge, uint64_t, archetype_edge);
 
 SET_TYPE_IMPL(type_set, int64_t);
 
@@ -1,7 +1,31 @@
 #include "str_utils.h"
 
+/* Multiply 'a' and 'b' into 128 bits and fold the halves together. */
+static inline uint64_t mum(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+uint64_t hash_mem(const void *ptr, size_t size) {
+  const uint8_t *bytes = ptr;
+  uint64_t       h = mum(size ^ HASH_P0, HASH_P1);
+
+  /* Consume a word at a time, the tail is padded with zeroes */
+  uint64_t word;
+  for (; size >= 8; size -= 8, bytes += 8) {
+    memcpy(&word, bytes, 8);
+    h = mum(h ^ word, HASH_P1);
+  }
+  if (size) {
+    word = 0;
+    memcpy(&word, bytes, size);
+    h = mum(h ^ word ^ HASH_P2, HASH_P1);
+  }
+  return mum(h ^ HASH_P3, h ^ HASH_P0);
+}
+
 uint64_t hash_vector(vec *v) {
-  return hash_bytes(v->elements, v->length * v->__el_size);
+  return hash_mem(v->elements, v->length * v->__el_size);
 }
 
 feach(push_to_set, uint64_t, hash, {
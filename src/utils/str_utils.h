@@ -16,6 +16,18 @@
 
 #include "csdsa.h"
 
+/* Odd constants with well mixed bits the hashes below multiply with. */
+#define HASH_P0 0x2d358dccaa6c78a5ull
+#define HASH_P1 0x8bb84b93962eacc9ull
+#define HASH_P2 0x4b33a62ed433d4a3ull
+#define HASH_P3 0x4d5a2da51de1aa47ull
+
+/* A fast 64-bit hash of 'size' bytes at 'ptr'. Component names and archetype
+   keys are hashed with it, a word at a time through 64x64->128 bit
+   multiplications. Unlike `hash_bytes` every input bit reaches every output
+   bit. */
+uint64_t hash_mem(const void *ptr, size_t size);
+
 uint64_t  hash_vector(vec *v);
 set *vec_to_set(vec *v, set *out);
 vec *set_to_vec(set *s, vec *out);
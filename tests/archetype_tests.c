@@ -0,0 +1,192 @@
+#include "gecs.h"
+#include "unity.h"
+
+void setUp() {}
+void tearDown() {}
+
+/*-------------------------------------------------------
+ * TESTS
+ *-------------------------------------------------------*/
+typedef struct Order Order;
+struct Order {
+  int64_t at;
+};
+
+typedef struct Mark Mark;
+struct Mark {
+  int64_t unused;
+};
+
+#define ORDER_ENTITIES 300
+
+/* Remove rows one by one and in batches, the survivors must keep the order
+   they were created in. */
+static void check_stable_removal(int8_t layout) {
+  log_set_level(LOG_ERROR);
+  g_core *w = g_create_world();
+  G_COMPONENT(w, Order);
+  G_COMPONENT(w, Mark);
+  G_LAYOUT(w, layout | G_LAYOUT_STABLE, Order, Mark);
+
+  static gid ids[ORDER_ENTITIES];
+  G_CREATE_ENTITIES(w, ORDER_ENTITIES, ids, Order, Mark);
+  for (int64_t i = 0; i < ORDER_ENTITIES; i++)
+    G_SET_COMPONENT(w, ids[i], Order, {.at = i});
+
+  for (int64_t i = 0; i < ORDER_ENTITIES; i += 3)
+    G_REM_COMPONENT(w, ids[i], Mark);
+
+  gid     batch[ORDER_ENTITIES];
+  int64_t n = 0;
+  for (int64_t i = 1; i < ORDER_ENTITIES; i += 3)
+    if (i % 2) batch[n++] = ids[i];
+  G_REM_COMPONENT_BATCH(w, batch, n, Mark);
+
+  int64_t seen = 0, last = -1;
+  for (g_pool it = G_GET_POOL(w, Order, Mark); !gq_done(it);
+       it = gq_next(it)) {
+    Order *o = gq_field(it, Order);
+    TEST_ASSERT_GREATER_THAN_INT64(last, o->at);
+    last = o->at;
+    seen++;
+  }
+  TEST_ASSERT_EQUAL_INT64(ORDER_ENTITIES - ORDER_ENTITIES / 3 - n, seen);
+
+  /* Every entity still finds its own row */
+  for (int64_t i = 0; i < ORDER_ENTITIES; i++) {
+    Order *o = G_GET_COMPONENT(w, ids[i], Order);
+    TEST_ASSERT_EQUAL_INT64(i, o->at);
+  }
+
+  g_destroy_world(w);
+}
+
+void stable_removal_aos() { check_stable_removal(G_LAYOUT_AOS); }
+void stable_removal_soa() { check_stable_removal(G_LAYOUT_SOA); }
+void stable_removal_chunked() { check_stable_removal(G_LAYOUT_CHUNKED); }
+
+/* Archetypes retire after one empty tick and are retired before the next */
+static g_core *retiring_world(void) {
+  log_set_level(LOG_ERROR);
+  g_core *w = g_create_world();
+  w->retire_after = 1;
+  G_COMPONENT(w, Order);
+  G_COMPONENT(w, Mark);
+  return w;
+}
+
+static void run_ticks(g_core *w, int64_t n) {
+  for (int64_t i = 0; i < n; i++)
+    g_progress(w);
+}
+
+static int64_t marked_rows;
+void count_marked(g_query *q) {
+  for (g_pool it = gq_seq(q); !gq_done(it); it = gq_next(it))
+    marked_rows++;
+}
+
+void retired_archetype_revives_intact() {
+  g_core *w = retiring_world();
+  G_SYSTEM(w, count_marked, SYS_READONLY, Order, Mark);
+
+  static gid ids[ORDER_ENTITIES];
+  G_CREATE_ENTITIES(w, ORDER_ENTITIES, ids, Order, Mark);
+  for (int64_t i = 0; i < ORDER_ENTITIES; i++)
+    G_SET_COMPONENT(w, ids[i], Order, {.at = i});
+  archetype *marked = G_GET_POOL(w, Order, Mark).entities.arch;
+
+  /* Emptied, it leaves the world once it stayed empty long enough */
+  G_REM_COMPONENT_BATCH(w, ids, ORDER_ENTITIES, Mark);
+  run_ticks(w, 2);
+  TEST_ASSERT_EQUAL_INT64(1, w->retired_archetypes.length);
+  TEST_ASSERT_EQUAL_PTR(marked, *cache_vec_at(&w->retired_archetypes, 0));
+
+  /* Systems stop running on it and pick it up again once revived */
+  marked_rows = 0;
+  g_progress(w);
+  TEST_ASSERT_EQUAL_INT64(0, marked_rows);
+
+  G_ADD_COMPONENT_BATCH(w, ids, ORDER_ENTITIES, Mark);
+  TEST_ASSERT_EQUAL_INT64(0, w->retired_archetypes.length);
+  TEST_ASSERT_EQUAL_PTR(marked, G_GET_POOL(w, Order, Mark).entities.arch);
+  for (int64_t i = 0; i < ORDER_ENTITIES; i++)
+    G_SET_COMPONENT(w, ids[i], Mark, {.unused = -i});
+
+  g_progress(w);
+  TEST_ASSERT_EQUAL_INT64(ORDER_ENTITIES, marked_rows);
+  for (int64_t i = 0; i < ORDER_ENTITIES; i++) {
+    Order *o = G_GET_COMPONENT(w, ids[i], Order);
+    Mark  *m = G_GET_COMPONENT(w, ids[i], Mark);
+    TEST_ASSERT_EQUAL_INT64(i, o->at);
+    TEST_ASSERT_EQUAL_INT64(-i, m->unused);
+  }
+  g_destroy_world(w);
+}
+
+#define BIT_COMPONENTS 7
+
+/* The component list "Bit0, Bit2" of the set bits of 'mask' */
+static void bit_list(int64_t mask, char *out) {
+  out[0] = 0;
+  for (int64_t b = 0; b < BIT_COMPONENTS; b++) {
+    if (!(mask & (1 << b))) continue;
+    if (out[0]) strcat(out, ", ");
+    sprintf(out + strlen(out), "Bit%ld", b);
+  }
+}
+
+void retired_pool_evicts_the_oldest() {
+  g_core *w = retiring_world();
+  char    name[8];
+  for (int64_t b = 0; b < BIT_COMPONENTS; b++) {
+    sprintf(name, "Bit%ld", b);
+    g_register_component(w, name, sizeof(int64_t));
+  }
+
+  /* One archetype per entity, the first is retired on its own */
+  int64_t n = ARCHETYPE_POOL_SIZE + 1;
+  gid     ids[ARCHETYPE_POOL_SIZE + 1];
+  char    list[64];
+  for (int64_t i = 0; i < n; i++) {
+    ids[i] = g_create_entity(w);
+    bit_list(i + 1, list);
+    g_add_component(w, ids[i], list);
+  }
+
+  bit_list(1, list);
+  archetype *oldest = G_GET_POOL(w, Bit0).entities.arch;
+  g_rem_component(w, ids[0], list);
+  run_ticks(w, 2);
+  TEST_ASSERT_EQUAL_INT64(1, w->retired_archetypes.length);
+
+  for (int64_t i = 1; i < n; i++) {
+    bit_list(i + 1, list);
+    g_rem_component(w, ids[i], list);
+  }
+  run_ticks(w, 2);
+  TEST_ASSERT_EQUAL_INT64(ARCHETYPE_POOL_SIZE, w->retired_archetypes.length);
+  for (int64_t i = 0; i < w->retired_archetypes.length; i++)
+    TEST_ASSERT_NOT_EQUAL(oldest, *cache_vec_at(&w->retired_archetypes, i));
+
+  /* An evicted archetype is simply created again */
+  bit_list(1, list);
+  g_add_component(w, ids[0], list);
+  *(int64_t *)g_get_component(w, ids[0], "Bit0") = 7;
+  TEST_ASSERT_EQUAL_INT64(ARCHETYPE_POOL_SIZE, w->retired_archetypes.length);
+  TEST_ASSERT_EQUAL_INT64(7, *(int64_t *)g_get_component(w, ids[0], "Bit0"));
+  g_destroy_world(w);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(stable_removal_aos);
+  RUN_TEST(stable_removal_soa);
+  RUN_TEST(stable_removal_chunked);
+  RUN_TEST(retired_archetype_revives_intact);
+  RUN_TEST(retired_pool_evicts_the_oldest);
+
+  UNITY_END();
+  return 0;
+}
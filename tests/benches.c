@@ -50,7 +50,7 @@ void bench_read_N_entities_components() {
     G_COMPONENT(world, CompA);
     G_COMPONENT(world, CompB);
 
-    G_SYSTEM(world, unpack_comp, CompA, CompB);
+    G_SYSTEM(world, unpack_comp, DEFAULT, CompA, CompB);
 
     // printf("bench_destroy_N_entities_with_2_components: %d Entities\n", cnt);
     for (int i = 0; i < cnt; i++) {
@@ -122,10 +122,139 @@ void bench_create_N_entities_with_2_components() {
   }
 }
 
+void bench_create_N_entities_with_2_components_bulk() {
+  printf("Bench Create N Entities with 2 Components in Bulk\n");
+
+  int entity_cnt[15] = {1,    4,     8,     16,     32,      64,      256, 1024,
+                        4096, 16000, 0};
+
+  int idx = 0;
+  log_set_level(LOG_ERROR);
+  while (entity_cnt[idx] != 0) {
+    int     cnt = entity_cnt[idx];
+    g_core *world = g_create_world();
+    G_COMPONENT(world, CompA);
+    G_COMPONENT(world, CompB);
+    gid *ids = malloc(sizeof(gid) * cnt);
+
+    bench_block({ G_CREATE_ENTITIES(world, cnt, ids, CompA, CompB); });
+
+    free(ids);
+    g_destroy_world(world);
+    idx++;
+  }
+}
+
+void bench_add_component_to_N_entities_batch() {
+  printf("Bench Add Component to N Entities in Batch\n");
+
+  int entity_cnt[15] = {1,    4,     8,     16,     32,      64,      256, 1024,
+                        4096, 16000, 0};
+
+  int idx = 0;
+  log_set_level(LOG_ERROR);
+  while (entity_cnt[idx] != 0) {
+    int     cnt = entity_cnt[idx];
+    g_core *world = g_create_world();
+    G_COMPONENT(world, CompA);
+    G_COMPONENT(world, CompB);
+    gid *ids = malloc(sizeof(gid) * cnt);
+    G_CREATE_ENTITIES(world, cnt, ids, CompA);
+
+    bench_block({ G_ADD_COMPONENT_BATCH(world, ids, cnt, CompB); });
+
+    free(ids);
+    g_destroy_world(world);
+    idx++;
+  }
+}
+
+typedef struct Spawner Spawner;
+struct Spawner {
+  int32_t count;
+};
+
+void spawn_comp(g_query *q) {
+  g_par elements = gq_vectorize(q);
+  for (int64_t row = 0; row < elements.arch->length; row++) {
+    gid      entt = *id_vec_at(&elements.arch->row_entities, row);
+    Spawner *s = gq_get(q, entt, Spawner);
+    for (int32_t i = 0; i < s->count; i++) {
+      gid child = gq_create_entity(q);
+      gq_add(q, child, CompA);
+      gq_set(q, child, CompB, {._ = 1});
+    }
+  }
+}
+
+void bench_spawn_N_entities_from_system() {
+  printf("Bench Spawn N Entities with 2 Components from a System\n");
+
+  int entity_cnt[15] = {1,    4,     8,     16,     32,      64,      256, 1024,
+                        4096, 16000, 0};
+
+  int idx = 0;
+  log_set_level(LOG_ERROR);
+  while (entity_cnt[idx] != 0) {
+    int     cnt = entity_cnt[idx];
+    g_core *world = g_create_world();
+    G_COMPONENT(world, CompA);
+    G_COMPONENT(world, CompB);
+    G_COMPONENT(world, Spawner);
+    G_SYSTEM(world, spawn_comp, DEFAULT, Spawner);
+
+    gid spawner = g_create_entity(world);
+    G_ADD_COMPONENT(world, spawner, Spawner);
+    G_SET_COMPONENT(world, spawner, Spawner, {.count = cnt});
+
+    bench_block({ g_progress(world); });
+
+    g_destroy_world(world);
+    idx++;
+  }
+}
+
+static void clear_range(g_par vec, int64_t start_at, int64_t stop_at,
+                        void *args) {
+  g_field a = gq_handle(vec, G_ID(CompA));
+  for (int64_t i = start_at; i < stop_at; i++)
+    gq_at(a, CompA, i)->_ = 0;
+}
+
+void bench_view_N_entities_across_archetypes() {
+  printf("Bench View N Entities across 2 Archetypes\n");
+
+  int entity_cnt[15] = {1,    4,     8,     16,     32,      64,      256, 1024,
+                        4096, 16000, 0};
+
+  int idx = 0;
+  log_set_level(LOG_ERROR);
+  while (entity_cnt[idx] != 0) {
+    int     cnt = entity_cnt[idx];
+    g_core *world = g_create_world();
+    G_COMPONENT(world, CompA);
+    G_COMPONENT(world, CompB);
+    matcher *view = G_VIEW(world, CompA);
+    gid     *ids = malloc(sizeof(gid) * cnt);
+    G_CREATE_ENTITIES(world, cnt, ids, CompA);
+    G_CREATE_ENTITIES(world, cnt, ids, CompA, CompB);
+
+    bench_block({ g_view_each(view, clear_range, NULL); });
+
+    free(ids);
+    g_destroy_world(world);
+    idx++;
+  }
+}
+
 int main(void) {
   bench_read_N_entities_components();
   bench_destroy_N_entities_with_2_components();
   bench_create_N_entities_with_2_components();
+  bench_create_N_entities_with_2_components_bulk();
+  bench_add_component_to_N_entities_batch();
+  bench_spawn_N_entities_from_system();
+  bench_view_N_entities_across_archetypes();
 
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include "gecs.h"
+#include "unity.h"
+
+void setUp() {}
+void tearDown() {}
+
+/*-------------------------------------------------------
+ * TESTS
+ *-------------------------------------------------------*/
+typedef struct Pos Pos;
+struct Pos {
+  int64_t x;
+};
+
+typedef struct Tag Tag;
+struct Tag {
+  int64_t unused;
+};
+
+typedef struct Ctl Ctl;
+struct Ctl {
+  gid target;
+};
+
+/* Enough entities to span several chunks */
+#define TRACKED 5000
+
+static int64_t seen;
+static bool    writing;
+static gid     ids[TRACKED + 1];
+
+void count_rows(g_query *q) {
+  for (g_pool it = gq_seq(q); !gq_done(it); it = gq_next(it))
+    seen++;
+}
+
+static int64_t run_tick(g_core *w) {
+  seen = 0;
+  g_progress(w);
+  return seen;
+}
+
+static g_core *tracked_world(int64_t n) {
+  log_set_level(LOG_ERROR);
+  g_core *w = g_create_world();
+  G_COMPONENT(w, Pos);
+  G_COMPONENT(w, Tag);
+  G_COMPONENT(w, Ctl);
+  G_LAYOUT(w, G_LAYOUT_CHUNKED, Pos);
+  G_LAYOUT(w, G_LAYOUT_CHUNKED, Pos, Tag);
+  G_CREATE_ENTITIES(w, n, ids, Pos);
+  writing = false;
+  return w;
+}
+
+void changed_skips_untouched_chunks() {
+  g_core *w = tracked_world(TRACKED);
+  G_SYSTEM(w, count_rows, DEFAULT, CHANGED(READ(Pos)));
+
+  TEST_ASSERT_EQUAL_INT64(TRACKED, run_tick(w));
+  TEST_ASSERT_EQUAL_INT64(0, run_tick(w));
+
+  /* Only the chunk holding the entity is processed again */
+  G_SET_COMPONENT(w, ids[TRACKED / 2], Pos, {.x = 1});
+  int64_t rows = run_tick(w);
+  TEST_ASSERT_GREATER_THAN_INT64(0, rows);
+  TEST_ASSERT_LESS_THAN_INT64(TRACKED, rows);
+  TEST_ASSERT_EQUAL_INT64(0, run_tick(w));
+  g_destroy_world(w);
+}
+
+void added_skips_untouched_chunks() {
+  g_core *w = tracked_world(TRACKED + 1);
+  G_SYSTEM(w, count_rows, DEFAULT, ADDED(READ(Tag)));
+
+  TEST_ASSERT_EQUAL_INT64(0, run_tick(w));
+  G_ADD_COMPONENT_BATCH(w, ids, TRACKED, Tag);
+  TEST_ASSERT_EQUAL_INT64(TRACKED, run_tick(w));
+  TEST_ASSERT_EQUAL_INT64(0, run_tick(w));
+
+  /* The last entity lands in the last chunk, the others were received
+     before the system last ran */
+  G_ADD_COMPONENT(w, ids[TRACKED], Tag);
+  int64_t rows = run_tick(w);
+  TEST_ASSERT_GREATER_THAN_INT64(0, rows);
+  TEST_ASSERT_LESS_THAN_INT64(TRACKED, rows);
+  g_destroy_world(w);
+}
+
+/* Writes an entity of another archetype through the query */
+void write_target(g_query *q) {
+  if (!writing) return;
+  for (g_pool it = gq_seq(q); !gq_done(it); it = gq_next(it)) {
+    Ctl *c = gq_field(it, Ctl);
+    gq_set(q, c->target, Pos, {.x = 2});
+  }
+}
+
+void gq_set_stamps_the_written_chunk() {
+  g_core *w = tracked_world(TRACKED);
+  G_SYSTEM(w, write_target, DEFAULT, Ctl);
+  G_SYSTEM(w, count_rows, DEFAULT, CHANGED(READ(Pos)));
+
+  gid ctl = g_create_entity(w);
+  G_ADD_COMPONENT(w, ctl, Ctl);
+  G_SET_COMPONENT(w, ctl, Ctl, {.target = ids[TRACKED / 2]});
+
+  TEST_ASSERT_EQUAL_INT64(TRACKED, run_tick(w));
+  TEST_ASSERT_EQUAL_INT64(0, run_tick(w));
+
+  /* The watcher may run before the writer within a tick */
+  writing = true;
+  int64_t rows = run_tick(w);
+  writing = false;
+  rows += run_tick(w);
+  TEST_ASSERT_GREATER_THAN_INT64(0, rows);
+  TEST_ASSERT_LESS_THAN_INT64(TRACKED, rows);
+  TEST_ASSERT_EQUAL_INT64(0, run_tick(w));
+
+  Pos *p = G_GET_COMPONENT(w, ids[TRACKED / 2], Pos);
+  TEST_ASSERT_EQUAL_INT64(2, p->x);
+  g_destroy_world(w);
+}
+
+/* Reads another entity of the watched component through the query */
+void read_while_watching(g_query *q) {
+  for (g_pool it = gq_seq(q); !gq_done(it); it = gq_next(it)) {
+    Pos *p = gq_get(q, ids[0], Pos);
+    seen += p->x == 0;
+  }
+}
+
+void gq_get_does_not_stamp_reads() {
+  g_core *w = tracked_world(TRACKED);
+  G_SYSTEM(w, read_while_watching, DEFAULT, CHANGED(READ(Pos)));
+
+  TEST_ASSERT_EQUAL_INT64(TRACKED, run_tick(w));
+  TEST_ASSERT_EQUAL_INT64(0, run_tick(w));
+  g_destroy_world(w);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(changed_skips_untouched_chunks);
+  RUN_TEST(added_skips_untouched_chunks);
+  RUN_TEST(gq_set_stamps_the_written_chunk);
+  RUN_TEST(gq_get_does_not_stamp_reads);
+
+  UNITY_END();
+  return 0;
+}
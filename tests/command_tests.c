@@ -0,0 +1,116 @@
+#include "gecs.h"
+#include "unity.h"
+
+void setUp() {}
+void tearDown() {}
+
+/*-------------------------------------------------------
+ * TESTS
+ *-------------------------------------------------------*/
+typedef struct Host Host;
+struct Host {
+  int64_t row;
+};
+
+typedef struct Extra Extra;
+struct Extra {
+  int64_t row;
+};
+
+#define HOSTS 20000
+
+static int64_t visible, readable;
+
+static gid entity_at(g_par vec, int64_t row) {
+  return *id_vec_at(&vec.arch->row_entities, row);
+}
+
+static g_core *host_world(g_system sys) {
+  log_set_level(LOG_ERROR);
+  g_core *w = g_create_world();
+  w->thread_count = 4;
+  w->each_serial_threshold = 1;
+  w->each_grain_size = 64;
+  G_COMPONENT(w, Host);
+  G_COMPONENT(w, Extra);
+  G_SYSTEM(w, sys, DEFAULT, Host);
+
+  static gid ids[HOSTS];
+  G_CREATE_ENTITIES(w, HOSTS, ids, Host);
+  for (int64_t i = 0; i < HOSTS; i++)
+    G_SET_COMPONENT(w, ids[i], Host, {.row = i});
+
+  visible = readable = 0;
+  return w;
+}
+
+feach(add_extra, g_pool, e, {
+  g_query *q = args;
+  gid      entt = entity_at(e.entities, e.idx);
+  Host    *h = gq_get(q, entt, Host);
+  gq_add(q, entt, Extra);
+  gq_set(q, entt, Extra, {.row = h->row});
+});
+
+/* Commands recorded by the workers of `gq_each` are visible to the rest of
+   the system once it joined. */
+void add_then_look(g_query *q) {
+  g_par vec = gq_vectorize(q);
+  gq_each(vec, add_extra, q);
+  for (int64_t row = 0; row < vec.arch->length; row++) {
+    gid entt = entity_at(vec, row);
+    if (!gq_has(q, entt, Extra)) continue;
+    visible++;
+    Host  *h = gq_get(q, entt, Host);
+    Extra *x = gq_get(q, entt, Extra);
+    if (x->row == h->row) readable++;
+  }
+}
+
+void commands_of_workers_are_visible() {
+  g_core *w = host_world(add_then_look);
+  g_progress(w);
+  TEST_ASSERT_EQUAL_INT64(HOSTS, visible);
+  TEST_ASSERT_EQUAL_INT64(HOSTS, readable);
+
+  /* The values recorded on the workers landed */
+  int64_t landed = 0;
+  for (g_pool it = G_GET_POOL(w, Host, Extra); !gq_done(it);
+       it = gq_next(it)) {
+    Host  *h = gq_field(it, Host);
+    Extra *x = gq_field(it, Extra);
+    landed += x->row == h->row;
+  }
+  TEST_ASSERT_EQUAL_INT64(HOSTS, landed);
+  g_destroy_world(w);
+}
+
+/* The removal is recorded after every add, whatever buffer each landed in,
+   so no entity keeps the component. */
+void add_then_remove(g_query *q) {
+  g_par vec = gq_vectorize(q);
+  gq_each(vec, add_extra, q);
+  for (int64_t row = 0; row < vec.arch->length; row++)
+    gq_rem(q, entity_at(vec, row), Extra);
+}
+
+void commands_apply_in_recording_order() {
+  g_core *w = host_world(add_then_remove);
+  g_progress(w);
+
+  int64_t kept = 0;
+  for (g_pool it = G_GET_POOL(w, Host); !gq_done(it); it = gq_next(it))
+    kept++;
+  TEST_ASSERT_EQUAL_INT64(HOSTS, kept);
+  g_destroy_world(w);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(commands_of_workers_are_visible);
+  RUN_TEST(commands_apply_in_recording_order);
+
+  UNITY_END();
+  return 0;
+}